@@ -5,33 +5,32 @@
 #include "sysutils.hpp"
 #include "verbs.hpp"
 #include "programs.hpp"
+#include "console.hpp"
 #include "isr.hpp"
 
 void setup()
 {
-  MCUSR = 0; // clear watchdog timer flags
+  System::reset_cause = MCUSR;
+  MCUSR = 0;     // clear watchdog timer flags
+  wdt_disable(); // the watchdog stays armed after a watchdog reset
 
-  if (SERIAL_ENABLE) // initialize serial interface
-    Serial.begin(SERIAL_RATE);
-  else // prepare to set up kRPC connection
-  {
-    Comm::conn = (HardwareSerial *)&Serial;
-    krpc_connection_config_t config;
-    config.speed = 115200;
-    config.config = SERIAL_8N1;
-    krpc_open(&Comm::conn, &config);
-    krpc_connect(Comm::conn, "LDSKY");
-  }
+  // load system configs
+  System::read_config();
 
-  // init keypad
-  Devices::keypad = new Devices::Keypad_I;
-
-  // init MAX7219 displays
-  Devices::lcd = new Devices::LC_Display;
+  // flight data recorder: keeps the recording over a reset
+  Recorder::init(System::reset_cause);
 
+  // stage 1: bring up the UI
   // init status lights
   Devices::status_led = new Devices::StatusDisplay;
 
+  // init MAX7219 displays
+  Devices::lcd = new Devices::LC_Display(System::conf->lc_rows);
+
+  // init keypad
+  Devices::keypad = new Devices::Keypad_I;
+
+  // stage 2: start the system manager
   // init sys
   SysUtils::sys = new SysUtils::SysManager;
 
@@ -39,16 +38,44 @@ void setup()
   Verbs::init_verbs();
   Programs::init_programs();
 
-  // TODO: read saved system state from EEPROM if so configured
+  // resume from the warm restart snapshot after a watchdog/manual reset
+  if (!(System::reset_cause & (_BV(PORF) | _BV(BORF))) &&
+      System::reset_cause & (_BV(WDRF) | _BV(EXTRF)))
+    System::warm_boot = (0 == SysUtils::sys->restore_checkpoint());
 
   // setup scheduled interrupts for system updates
-  System::timer_init();
+  timers_init();
+
+  // the keypad is live from here on
+  System::boot_us = micros();
+
+  // stage 3: serial links
+  if (SERIAL_ENABLE) // diagnostics console
+  {
+    Serial.begin(SERIAL_RATE);
+    Serial.print(System::warm_boot ? "warm" : "cold");
+    Serial.print(" boot, keypad ready after (us): ");
+    Serial.println(System::boot_us);
+  }
+  Comm::open(); // kRPC handshake runs in the background from loop()
 }
 
 void loop()
 {
 
+  Comm::update(); // background kRPC handshake
+  Telemetry::update(); // sample one due telemetry channel
+  Telemetry::record(); // flight data recorder
   SysUtils::sys->update();
+  Wheel::run_deferred(); // deferred timer callbacks, e.g. control loops
+  Console::update(); // diagnostics console on Serial
+  System::loop_stats_update();
+
+  // idle until the next interrupt if no work is pending
+  cli();
+  if (!SysUtils::sys->has_pending_work() && !Wheel::deferred_pending())
+    System::idle_sleep(); // re-enables interrupts
+  sei();
 
   // Devices::lcd->setUL(1, 1234567890L, true);
 
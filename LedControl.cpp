@@ -55,20 +55,20 @@ LedControl::LedControl(int csPin, int numDevices)
   SPI.setBitOrder(MSBFIRST);
   SPI.setDataMode(SPI_MODE0);
   SPI.begin();
-  digitalWrite(SPI_CS, HIGH);
+  cs.attach(SPI_CS);
+  cs.write(HIGH);
   for (int i = 0; i < 64; i++)
     status[i] = 0x00;
-  for (int i = 0; i < maxDevices; i++)
-  {
-    spiTransfer(i, OP_DISPLAYTEST, 0);
-    //scanlimit is set to max on startup
-    setScanLimit(i, 7);
-    //decode is done in source
-    spiTransfer(i, OP_DECODEMODE, 0);
-    clearDisplay(i);
-    //we go into shutdown-mode on startup
-    shutdown(i, true);
-  }
+  //init frames address all devices at once
+  spiTransferAll(OP_DISPLAYTEST, 0);
+  //scanlimit is set to max on startup
+  spiTransferAll(OP_SCANLIMIT, 7);
+  //decode is done in source
+  spiTransferAll(OP_DECODEMODE, 0);
+  for (int i = 0; i < 8; i++)
+    spiTransferAll(OP_DIGIT0 + i, 0);
+  //we go into shutdown-mode on startup
+  spiTransferAll(OP_SHUTDOWN, 0);
 }
 
 int LedControl::getDeviceCount()
@@ -86,6 +86,11 @@ void LedControl::shutdown(int addr, bool b)
     spiTransfer(addr, OP_SHUTDOWN, 1);
 }
 
+void LedControl::shutdownAll(bool b)
+{
+  spiTransferAll(OP_SHUTDOWN, b ? 0 : 1);
+}
+
 void LedControl::setScanLimit(int addr, int limit)
 {
   if (addr < 0 || addr >= maxDevices)
@@ -102,6 +107,12 @@ void LedControl::setIntensity(int addr, int intensity)
     spiTransfer(addr, OP_INTENSITY, intensity);
 }
 
+void LedControl::setIntensityAll(int intensity)
+{
+  if (intensity >= 0 && intensity < 16)
+    spiTransferAll(OP_INTENSITY, intensity);
+}
+
 void LedControl::clearDisplay(int addr)
 {
   int offset;
@@ -217,7 +228,7 @@ void LedControl::spiTransfer(int addr, volatile byte opcode, volatile byte data)
   spidata[offset + 1] = opcode;
   spidata[offset] = data;
   //enable the line
-  digitalWrite(SPI_CS, LOW);
+  cs.write(LOW);
   //Now shift out the data
   SPI.beginTransaction(SPISettings(F_CPU, MSBFIRST, SPI_MODE0));
   for (int i = maxbytes; i > 0; i--)
@@ -225,5 +236,22 @@ void LedControl::spiTransfer(int addr, volatile byte opcode, volatile byte data)
   //       shiftOut(MOSI,SCK,MSBFIRST,spidata[i-1]);
   //latch the data onto the display
   SPI.endTransaction();
-  digitalWrite(SPI_CS, HIGH);
+  cs.write(HIGH);
+}
+
+void LedControl::spiTransferAll(byte opcode, byte data)
+{
+  int maxbytes = maxDevices * 2;
+
+  for (int i = 0; i < maxbytes; i += 2)
+  {
+    spidata[i + 1] = opcode;
+    spidata[i] = data;
+  }
+  cs.write(LOW);
+  SPI.beginTransaction(SPISettings(F_CPU, MSBFIRST, SPI_MODE0));
+  for (int i = maxbytes; i > 0; i--)
+    SPI.transfer(spidata[i - 1]);
+  SPI.endTransaction();
+  cs.write(HIGH);
 }
@@ -35,6 +35,8 @@
 #include <WProgram.h>
 #endif
 
+#include "fastpin.hpp"
+
 /*
  * Segments to be switched on for characters and digits on
  * 7-Segment Displays
@@ -64,6 +66,8 @@ class LedControl {
         byte spidata[16];
         /* Send out a single command to the device */
         void spiTransfer(int addr, byte opcode, byte data);
+        /* Send out the same command to all devices in one frame */
+        void spiTransferAll(byte opcode, byte data);
 
         /* We keep track of the led-status for all 8 devices in this array */
         byte status[64];
@@ -73,6 +77,8 @@ class LedControl {
         int SPI_CLK;
         /* This one is driven LOW for chip selectzion */
         int SPI_CS;
+        /* SPI_CS resolved to its port and mask, for spiTransfer() */
+        FastIO::PinRef cs;
         /* The maximum number of devices we use */
         int maxDevices;
 
@@ -103,6 +109,14 @@ class LedControl {
          */
         void shutdown(int addr, bool status);
 
+        /* 
+         * Set the shutdown (power saving) mode for all devices at once
+         * Params :
+         * status	If true the devices go into power-down mode. Set to false
+         *		for normal operation.
+         */
+        void shutdownAll(bool status);
+
         /* 
          * Set the number of digits (or rows) to be displayed.
          * See datasheet for sideeffects of the scanlimit on the brightness
@@ -121,6 +135,13 @@ class LedControl {
          */
         void setIntensity(int addr, int intensity);
 
+        /* 
+         * Set the brightness of all displays at once.
+         * Params:
+         * intensity	the brightness of the displays. (0..15)
+         */
+        void setIntensityAll(int intensity);
+
         /* 
          * Switch all Leds on the display off. 
          * Params:
@@ -10,19 +10,40 @@
 #include <EEPROM.h>
 #include <avr/wdt.h>
 #include <avr/io.h>
+#include <avr/sleep.h>
+#include <avr/eeprom.h>
+#include <util/crc16.h>
 
 #include "data.h"
 
 /*===== global configs =====*/
 #define DEBUG 1
-#define SERIAL_ENABLE 1
+#define SERIAL_ENABLE 1 // diagnostics console on Serial (see console.hpp)
 #define SERIAL_RATE 115200
+#define KRPC_RATE 115200 // 250000 and 500000 are exact at 16 MHz
+#define KRPC_USART 1     // kRPC port: 1 to 3 (TX1/RX1 on pins 18/19)
+#define USART_RX_LEN 512 // kRPC receive ring, in bytes (a power of two)
+#define USART_TX_LEN 64  // kRPC transmit ring, in bytes (a power of two)
+#define KRPC_CONNECT_TIMEOUT 100 // per handshake attempt, in milliseconds
+#define KRPC_CALL_TIMEOUT 1000   // per kRPC call, in milliseconds
+#define KRPC_RETRY_DELAY 1000    // between handshake attempts
+#define KRPC_QUIET_MS 250        // line quiet time to resync a dirty link
+#define KRPC_RESYNC_MS 3000      // then give up and redo the handshake
+#define ORBIT_SAMPLE_MS 10000    // state vector resample period for verb 82
+#define TLM_DEPTH 3              // samples kept per telemetry channel
+#define TLM_IDLE_MS 2000         // stop sampling channels unread this long
+#define CONSOLE_LINE_LEN 32      // longest console command line
+#define CONSOLE_WATCH_MS 1000    // console watch repeat period
 #define RESET_EEPROM 0
 #define RESET_CONF 0
 
 /* ===== System timer ===== */
-#define INT_FREQ_1 4  // screen update frequency, in Hz
-#define INT_FREQ_2 20 // keyboard update frequency
+// NOTE: periodic work runs on the 1 kHz timer wheel (see wheel.hpp), so
+//       rates are divisors of 1000
+#define INT_FREQ_1 4   // screen update frequency at boot, in Hz
+#define INT_FREQ_2 200 // keypad scan frequency, in Hz (4 scans to debounce)
+#define WHEEL_TIMERS 8 // timer wheel callbacks (at most 8)
+#define STAT_WINDOW_MS 1000 // main loop statistics window, in milliseconds
 
 /* ===== Misc pin configs ===== */
 #define TONE_PIN 53
@@ -42,7 +63,7 @@
 #define LED_HI_G 44 // TODO: high-G alarm
 #define LED_HEAT 45 // TODO: heat alarm
 #define LED_CHUT 46 // TODO: chute deployed
-const byte LED_PINS[NUM_LED] =
+constexpr byte LED_PINS[NUM_LED] =
     {LED_UPLK,
      LED_KYRL,
      LED_PGER,
@@ -66,10 +87,12 @@ enum LED_PINS_P
 /* ===== display configs ===== */
 #define DEFAULT_DELAY_TIME 1000
 #define LC_LUM 1 // default luminosity
-#define NUM_LC 4
+#define NUM_LC 4 // default rows, all on the first chain
 // #define LC_DIN 12
-#define LC_CS 10
 // #define LC_CLK 11
+#define LC_MAX_CHAINS 2 // MAX7219 chains, sharing DIN/CLK
+#define LC_CHAIN_LEN 8  // max devices (rows) per chain
+const byte LC_CS_PINS[LC_MAX_CHAINS] = {10, 9}; // chip select per chain
 #define LC_ROW_LEN 8
 #define LC_FLASH_DELAY 400 // in milliseconds
 
@@ -87,8 +110,29 @@ const char KEYPAD_KEYS[KEYPAD_ROWS][KEYPAD_COLS] = { // Define the Keymap
     {'4', '5', '6', 'B'},
     {'7', '8', '9', 'C'},
     {'.', '0', '-', 'D'}};
-const byte KEYPAD_ROW_PINS[KEYPAD_ROWS] = {A11, A10, A9, A8};   // TODO
-const byte KEYPAD_COL_PINS[KEYPAD_COLS] = {A15, A14, A13, A12}; // TODO
+constexpr byte KEYPAD_ROW_PINS[KEYPAD_ROWS] = {A11, A10, A9, A8};   // TODO
+constexpr byte KEYPAD_COL_PINS[KEYPAD_COLS] = {A15, A14, A13, A12}; // TODO
+// NOTE: all keypad pins must be on one port (port K on the Mega)
+#define KEYPAD_QUEUE_LEN 8   // key events buffered for the UI (power of 2)
+#define KEYPAD_HOLD_MS 600   // a key held this long emits a hold event
+#define KEYPAD_REPEAT_MS 150 // then cursor keys repeat at this period
+#define KEYPAD_SETTLE_US 2   // row settling time per scanned column
+
+/* ===== EEPROM configs ===== */
+#define EE_QUEUE_JOBS 8  // max queued asynchronous EEPROM writes
+#define EE_QUEUE_BUF 128 // data buffer shared by queued writes, in bytes
+
+/* ===== script VM configs ===== */
+#define VM_PROFILE 1           // time each instruction (adds a micros() call)
+#define VM_NUM_REGS 8          // float registers per script
+#define VM_STEP_OPS 16         // max instructions per program step
+#define VM_WAIT_MS 50          // telemetry waits re-check this often
+#define VM_SCRIPT_SLOTS 4      // EEPROM script slots, after the config journal
+#define VM_SCRIPT_LEN 512      // bytes per slot, including the 4-byte header
+#define VM_PGM_EE 10           // first program id running an EEPROM slot
+#define VM_PGM_ROM 20          // program id running the built-in script
+#define VM_UPLOAD_CHUNK 32     // bytes acknowledged at a time during upload
+#define VM_UPLOAD_TIMEOUT 5000 // upload aborts after this long without data
 
 /* ===== sysutils configs ===== */
 // input key bindings
@@ -96,6 +140,7 @@ const byte KEYPAD_COL_PINS[KEYPAD_COLS] = {A15, A14, A13, A12}; // TODO
 #define M_DOWN_KEY 'B'
 #define M_ENTR_KEY 'C'
 #define M_EXIT_KEY 'D'
+#define IW_MAX_FIELDS 3 // max fields per input window
 // sysmanager
 #define PVN_PGM 0
 #define PVN_VERB 1
@@ -103,6 +148,23 @@ const byte KEYPAD_COL_PINS[KEYPAD_COLS] = {A15, A14, A13, A12}; // TODO
 #define ERR_NULL 0
 #define ERR_PGM -1
 #define ERR_OPR -2
+#define WAKE_QUEUE_LEN 8 // max pending verb/program wake-ups
+// warm restart snapshot
+#define WARM_MAGIC 0x4C44  // marks a snapshot in .noinit SRAM
+#define WARM_MAX_PGM 4     // max active programs kept across a warm restart
+#define WARM_DATA_LEN 64   // program data bytes kept across a warm restart
+#define WARM_CKPT_MS 100   // snapshot period, in milliseconds
+// flight data recorder
+#define FDR_LEN 1024          // ring size, in bytes (a power of two)
+#define FDR_PERIOD_MS 500     // telemetry sample period
+#define FDR_KEY_EVERY 16      // samples between keyframes
+#define FDR_DUMP_TIMEOUT 1000 // an abandoned dump unfreezes after this
+#define FDR_MAGIC 0x4644     // marks a recording in .noinit SRAM
+// supervisor
+#define SUP_BUDGET WDTO_2S // default time budget per verb/program call
+// closed-loop control
+// NOTE: loop rate and gains: gains.hpp
+#define CTL_DEADBAND 328 // smallest control change written (Q16.16, 0.005)
 
 /* ===== data structure definitions ===== */
 
@@ -113,10 +175,17 @@ typedef struct CT_Config
   bool splash = 0;
   bool fancy = 0;
   int fancy_delay = 50; // in milliseconds
+  // display refresh configs
+  int disp_freq_hi = 50;     // refresh rate while the UI is active, in Hz
+  int disp_freq_lo = 4;      // refresh rate while idle, in Hz
+  int disp_active_ms = 2000; // UI stays active this long after a key press
+  // display layout (takes effect at boot; set with verb 23)
+  uint8_t lc_rows[LC_MAX_CHAINS] = {NUM_LC, 0}; // rows per MAX7219 chain
   // app configs
   int placeholder;
 } CT_Config;
 const uint16_t CONFIG_ADDRESS = 0x0;
 const int CONFIG_LEN = sizeof(CT_Config);
+const int CONFIG_JOURNAL_LEN = 1024; // EEPROM bytes reserved for the journal
 
 #endif // BASE_H
@@ -8,7 +8,9 @@
 
 #include "base.h"
 #include "system.hpp"
-#include <HardwareSerial.h>
+#include "devices.hpp"
+#include "orbit.hpp"
+#include "usart.hpp"
 
 // kRPC libs
 #include <krpc.h>
@@ -19,13 +21,399 @@
 namespace Comm
 {
 
+// NOTE: the core's Serial owns USART0's interrupts
+#if KRPC_USART < 1 || KRPC_USART > 3
+#error "KRPC_USART must be 1, 2 or 3"
+#endif
+
 // kRPC objects
+Usart link(USART_REGS(KRPC_USART)); // serviced from isr.hpp
 HardwareSerial *conn;
 krpc_SpaceCenter_Control_t control;
 krpc_SpaceCenter_Vessel_t vessel;
 krpc_SpaceCenter_Flight_t flight;
 krpc_SpaceCenter_Orbit_t orbit;
 krpc_MechJeb_AscentAutopilot_t mj_ascent;
+bool flight_ok = false;  // flight object is valid
+bool control_ok = false; // control object is valid
+
+/* ===== connection managing ===== */
+
+enum conn_state_t // kRPC link state
+{
+  CONN_OFF,        // link not opened
+  CONN_CONNECTING, // handshake in progress
+  CONN_UP          // connected
+} conn_state = CONN_OFF;
+unsigned long conn_retry_at = 0; // time of the next handshake attempt
+unsigned long connect_ms = 0;    // time at which the link came up
+int connect_attempts = 0;        // handshake attempts so far
+
+// open the serial port; the handshake runs later from update()
+void open()
+{
+  // NOTE: not krpc_open(); it would call the base class begin()
+  link.begin(KRPC_RATE);
+  conn = &link;
+  conn->setTimeout(KRPC_CONNECT_TIMEOUT); // bound each handshake attempt
+  conn_state = CONN_CONNECTING;
+  conn_retry_at = millis();
+}
+
+// step the kRPC handshake in the background; call from the main loop
+// NOTE: the UPLINK light flashes while connecting and stays lit once up
+void update()
+{
+  if (conn_state != CONN_CONNECTING)
+    return;
+  Devices::status_led->setBlink(LED_UPLK_P);
+  if ((long)(millis() - conn_retry_at) < 0)
+    return;
+  connect_attempts += 1;
+  if (KRPC_OK == krpc_connect(conn, "LDSKY"))
+  {
+    conn->setTimeout(KRPC_CALL_TIMEOUT);
+    conn_state = CONN_UP;
+    connect_ms = millis();
+    Devices::status_led->setStatus(LED_UPLK_P, true);
+  }
+  else
+    conn_retry_at = millis() + KRPC_RETRY_DELAY;
+}
+
+/* ===== transaction statistics ===== */
+// NOTE: a transaction is one Comm entry point (a telemetry sample, a
+//       control input, ...), i.e. one or more kRPC round trips; for
+//       byte-level timing, capture the link with tools/krpctrace.py
+
+unsigned long xact_count = 0;    // transactions so far
+unsigned long xact_errors = 0;   // failed transactions
+unsigned long xact_us_last = 0;  // duration of the last transaction
+unsigned long xact_us_max = 0;   // longest transaction
+unsigned long xact_us_total = 0; // all transactions
+unsigned long xact_t0;
+volatile bool xact_open = false; // a transaction is in flight
+
+/* ===== link recovery ===== */
+// NOTE: a call cut short by the supervisor, or one that failed on the
+//       link (e.g. timed out), may still get its reply; clean error
+//       replies and requests never sent leave the link alone. A dirty
+//       link stays dirty until
+//       the line has been quiet for KRPC_QUIET_MS, and transactions fail
+//       meanwhile. A line that never quiets down gets a new handshake
+// NOTE: an unwound call may also leak the heap blocks of a reply being
+//       decoded; xact_unwinds counts them apart for that reason
+
+bool link_dirty = false;       // a late reply may still come in
+unsigned long quiet_at;        // time of the last byte seen while dirty
+unsigned long dirty_at;        // time the link got dirty
+unsigned int xact_unwinds = 0; // transactions unwound by the supervisor
+unsigned int resyncs = 0;      // dirty link recovered by draining
+unsigned int reconnects = 0;   // dirty link recovered by a handshake
+
+void mark_dirty()
+{
+  if (!link_dirty)
+    dirty_at = millis();
+  quiet_at = millis();
+  link_dirty = true;
+}
+
+// the supervisor is unwinding a call; call from ISR(WDT_vect)
+void xact_abort()
+{
+  if (!xact_open)
+    return;
+  xact_open = false;
+  xact_unwinds += 1;
+  mark_dirty();
+}
+
+// drain a dirty link; returns 0 once it is clean, -1 otherwise
+int resync()
+{
+  unsigned long t = millis();
+  if (conn->available() > 0)
+  {
+    while (conn->available() > 0)
+      conn->read();
+    quiet_at = t;
+  }
+  if (t - quiet_at >= KRPC_QUIET_MS)
+  {
+    link_dirty = false;
+    resyncs += 1;
+    return 0;
+  }
+  if (t - dirty_at >= KRPC_RESYNC_MS)
+  {
+    link_dirty = false;
+    reconnects += 1;
+    flight_ok = control_ok = false;
+    conn_state = CONN_CONNECTING; // see update()
+    conn_retry_at = t;
+  }
+  return -1;
+}
+
+/* ===== transactions ===== */
+
+// start a transaction; returns 0, or -1 if the link isn't usable yet
+// NOTE: a failed start is not a transaction; don't call xact_end()
+int xact_begin()
+{
+  if (link_dirty && 0 != resync())
+    return -1;
+  if (conn_state != CONN_UP)
+    return -1;
+  xact_t0 = micros();
+  xact_open = true;
+  return 0;
+}
+// whether a call failed on the link, s.t. bytes may still come in
+inline bool link_error(krpc_error_t err)
+{
+  return err == KRPC_ERROR_IO || err == KRPC_ERROR_EOF ||
+         err == KRPC_ERROR_DECODING_FAILED;
+}
+
+// record the end of a transaction; returns 0 if err is KRPC_OK, -1
+// otherwise
+int xact_end(krpc_error_t err)
+{
+  xact_open = false;
+  xact_us_last = micros() - xact_t0;
+  xact_us_total += xact_us_last;
+  if (xact_us_last > xact_us_max)
+    xact_us_max = xact_us_last;
+  xact_count += 1;
+  if (KRPC_OK == err)
+    return 0;
+  xact_errors += 1;
+  if (link_error(err))
+    mark_dirty();
+  return -1;
+}
+
+/* ===== flight telemetry ===== */
+
+// look up the flight object in the body's rotating frame, if not cached
+// NOTE: costs 5 calls after a vessel or SOI change; returns the error of
+//       the call that failed, or KRPC_OK
+krpc_error_t open_flight()
+{
+  if (flight_ok)
+    return KRPC_OK;
+  if (conn_state != CONN_UP)
+    return KRPC_ERROR_CONNECTION_FAILED;
+  krpc_SpaceCenter_CelestialBody_t b;
+  krpc_SpaceCenter_ReferenceFrame_t frame;
+  krpc_error_t err;
+  if (KRPC_OK != (err = krpc_SpaceCenter_ActiveVessel(conn, &vessel)) ||
+      KRPC_OK != (err = krpc_SpaceCenter_Vessel_Orbit(conn, &orbit,
+                                                      vessel)) ||
+      KRPC_OK != (err = krpc_SpaceCenter_Orbit_Body(conn, &b, orbit)) ||
+      KRPC_OK != (err = krpc_SpaceCenter_CelestialBody_ReferenceFrame(
+                      conn, &frame, b)) ||
+      KRPC_OK != (err = krpc_SpaceCenter_Vessel_Flight(conn, &flight, vessel,
+                                                       frame)))
+    return err;
+  flight_ok = true;
+  return KRPC_OK;
+}
+// drop the cached flight object, e.g. after a failed call
+void close_flight()
+{
+  flight_ok = false;
+}
+
+/* ===== vessel control ===== */
+
+enum control_t // control inputs
+{
+  CTL_THROTTLE, // 0 to 1
+  CTL_PITCH,    // -1 to 1
+  CTL_YAW,      // -1 to 1
+  CTL_ROLL,     // -1 to 1
+  CTL_SAS,      // on if non-zero
+  CTL_RCS,      // on if non-zero
+  CTL_GEAR,     // down if non-zero
+  NUM_CTL
+};
+
+// look up the active vessel's control object, if not cached; returns
+// the error of the call that failed, or KRPC_OK
+krpc_error_t open_control()
+{
+  if (control_ok)
+    return KRPC_OK;
+  if (conn_state != CONN_UP)
+    return KRPC_ERROR_CONNECTION_FAILED;
+  krpc_error_t err;
+  if (KRPC_OK != (err = krpc_SpaceCenter_ActiveVessel(conn, &vessel)) ||
+      KRPC_OK != (err = krpc_SpaceCenter_Vessel_Control(conn, &control,
+                                                        vessel)))
+    return err;
+  control_ok = true;
+  return KRPC_OK;
+}
+
+// set a control input; returns 0 on success, -1 otherwise
+int set_control(int c, float v)
+{
+  if (c < 0 || c >= NUM_CTL || 0 != xact_begin())
+    return -1;
+  krpc_error_t err = open_control();
+  if (KRPC_OK != err)
+    return xact_end(err);
+  switch (c)
+  {
+  case CTL_THROTTLE:
+    err = krpc_SpaceCenter_Control_set_Throttle(conn, control, v);
+    break;
+  case CTL_PITCH:
+    err = krpc_SpaceCenter_Control_set_Pitch(conn, control, v);
+    break;
+  case CTL_YAW:
+    err = krpc_SpaceCenter_Control_set_Yaw(conn, control, v);
+    break;
+  case CTL_ROLL:
+    err = krpc_SpaceCenter_Control_set_Roll(conn, control, v);
+    break;
+  case CTL_SAS:
+    err = krpc_SpaceCenter_Control_set_SAS(conn, control, v != 0);
+    break;
+  case CTL_RCS:
+    err = krpc_SpaceCenter_Control_set_RCS(conn, control, v != 0);
+    break;
+  default: // CTL_GEAR
+    err = krpc_SpaceCenter_Control_set_Gear(conn, control, v != 0);
+    break;
+  }
+  if (KRPC_OK != err)
+    control_ok = false; // vessel may have changed; look it up again
+  return xact_end(err);
+}
+
+// read an axis control input (throttle, pitch, yaw or roll); returns 0
+// on success, -1 otherwise
+int get_control(int c, float *v)
+{
+  if (c < 0 || c > CTL_ROLL || 0 != xact_begin())
+    return -1;
+  krpc_error_t err = open_control();
+  if (KRPC_OK != err)
+    return xact_end(err);
+  switch (c)
+  {
+  case CTL_THROTTLE:
+    err = krpc_SpaceCenter_Control_Throttle(conn, v, control);
+    break;
+  case CTL_PITCH:
+    err = krpc_SpaceCenter_Control_Pitch(conn, v, control);
+    break;
+  case CTL_YAW:
+    err = krpc_SpaceCenter_Control_Yaw(conn, v, control);
+    break;
+  default: // CTL_ROLL
+    err = krpc_SpaceCenter_Control_Roll(conn, v, control);
+    break;
+  }
+  if (KRPC_OK != err)
+    control_ok = false;
+  return xact_end(err);
+}
+
+// activate the next stage; returns 0 on success, -1 otherwise
+int stage()
+{
+  if (0 != xact_begin())
+    return -1;
+  krpc_error_t err = open_control();
+  if (KRPC_OK != err)
+    return xact_end(err);
+  krpc_list_object_t activated = {0, NULL};
+  err = krpc_SpaceCenter_Control_ActivateNextStage(conn, &activated, control);
+  free(activated.items); // the new vessels aren't needed
+  if (KRPC_OK != err)
+    control_ok = false;
+  return xact_end(err);
+}
+
+/* ===== state vector sampling ===== */
+
+krpc_SpaceCenter_CelestialBody_t body = 0; // body of the last sample
+krpc_SpaceCenter_ReferenceFrame_t body_frame;
+float body_mu, body_radius;
+unsigned long orbit_samples = 0; // successful samples so far
+
+// sample the active vessel's state vector for the orbit propagator
+// NOTE: body constants are only fetched again after an SOI change, so a
+//       sample normally costs 4 calls; returns the error of the call that
+//       failed, or KRPC_OK
+krpc_error_t read_state(Orbit::State *s)
+{
+  if (conn_state != CONN_UP)
+    return KRPC_ERROR_CONNECTION_FAILED;
+  krpc_SpaceCenter_CelestialBody_t b;
+  krpc_tuple_double_double_double_t r, v;
+  krpc_error_t err;
+  if (KRPC_OK != (err = krpc_SpaceCenter_ActiveVessel(conn, &vessel)) ||
+      KRPC_OK != (err = krpc_SpaceCenter_Vessel_Orbit(conn, &orbit,
+                                                      vessel)) ||
+      KRPC_OK != (err = krpc_SpaceCenter_Orbit_Body(conn, &b, orbit)))
+    return err;
+  if (b != body)
+  {
+    if (KRPC_OK !=
+            (err = krpc_SpaceCenter_CelestialBody_NonRotatingReferenceFrame(
+                 conn, &body_frame, b)) ||
+        KRPC_OK != (err = krpc_SpaceCenter_CelestialBody_GravitationalParameter(
+                        conn, &body_mu, b)) ||
+        KRPC_OK != (err = krpc_SpaceCenter_CelestialBody_EquatorialRadius(
+                        conn, &body_radius, b)))
+      return err;
+    body = b;
+    close_flight(); // telemetry frame belongs to the old body
+  }
+  if (KRPC_OK != (err = krpc_SpaceCenter_Vessel_Position(conn, &r, vessel,
+                                                         body_frame)) ||
+      KRPC_OK != (err = krpc_SpaceCenter_Vessel_Velocity(conn, &v, vessel,
+                                                         body_frame)))
+    return err;
+  s->r[0] = r.e0;
+  s->r[1] = r.e1;
+  s->r[2] = r.e2;
+  s->v[0] = v.e0;
+  s->v[1] = v.e1;
+  s->v[2] = v.e2;
+  s->mu = body_mu;
+  s->radius = body_radius;
+  orbit_samples += 1;
+  return KRPC_OK;
+}
+int sample_state(Orbit::State *s)
+{
+  if (0 != xact_begin())
+    return -1;
+  return xact_end(read_state(s));
+}
+
+/* ===== vessel refresh ===== */
+
+// drop the cached vessel objects and look them up again, e.g. after a
+// vessel switch; returns 0 on success, -1 otherwise
+int refresh()
+{
+  if (0 != xact_begin())
+    return -1;
+  close_flight();
+  control_ok = false;
+  krpc_error_t err = open_flight();
+  if (KRPC_OK == err)
+    err = open_control();
+  return xact_end(err);
+}
 
 } // namespace Comm
 
@@ -0,0 +1,377 @@
+/*
+ * Diagnostics console
+ * Line commands on Serial (USB), for looking into the system while kRPC
+ * runs on its own USART
+ * NOTE: never blocks the main loop: input is read as it comes, and a
+ *       reply goes out one line per update(), only into an empty TX
+ *       buffer, so reply lines stay under SERIAL_TX_BUFFER_SIZE bytes
+ * NOTE: type "help" for the command list
+ */
+
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#include "base.h"
+#include "system.hpp"
+#include "sysutils.hpp"
+#include "comm.hpp"
+#include "control.hpp"
+#include "telemetry.hpp"
+#include "vm.hpp"
+
+namespace Console
+{
+
+char line[CONSOLE_LINE_LEN + 1]; // command line being typed
+uint8_t line_len = 0;
+bool line_over = false; // line too long; dropped at its end
+long args[2];           // numeric arguments of the command
+uint8_t argc = 0;
+
+/* ===== commands ===== */
+// NOTE: a command prints line i of its reply; returns false after the
+//       last line
+
+bool cmd_help(uint8_t i)
+{
+  if (i == 0)
+    Serial.println(F("help stat sup link usart tlm vm ctl wheel clear "
+                     "vn <v> <n>"));
+  else
+    Serial.println(F("watch <cmd>: repeat each second, until input"));
+  return i == 0;
+}
+
+bool cmd_stat(uint8_t i)
+{
+  Serial.print(F("duty "));
+  Serial.print(System::duty_pm / 10.0, 1);
+  Serial.print(F("% loops/s "));
+  Serial.print(System::loop_rate);
+  Serial.print(F(" sleeps/s "));
+  Serial.print(System::sleep_rate);
+  Serial.print(F(" disp Hz "));
+  Serial.println(System::disp_freq);
+  return false;
+}
+
+bool cmd_sup(uint8_t i)
+{
+  Serial.print(F("overruns "));
+  Serial.print(System::sup_overruns);
+  Serial.print(F(" last verb "));
+  Serial.print(System::sup_verb);
+  Serial.print(F(" program "));
+  Serial.println(System::sup_pgm);
+  return false;
+}
+
+bool cmd_link(uint8_t i)
+{
+  if (i == 0)
+  {
+    Serial.print(F("krpc state "));
+    Serial.print(Comm::conn_state);
+    Serial.print(F(" tries "));
+    Serial.print(Comm::connect_attempts);
+    Serial.print(F(" up at ms "));
+    Serial.println(Comm::connect_ms);
+    return true;
+  }
+  if (i == 1)
+  {
+    Serial.print(F("unwound "));
+    Serial.print(Comm::xact_unwinds);
+    Serial.print(F(" resync "));
+    Serial.print(Comm::resyncs);
+    Serial.print(F(" reconnect "));
+    Serial.println(Comm::reconnects);
+    return true;
+  }
+  unsigned long n = Comm::xact_count;
+  Serial.print(F("xact "));
+  Serial.print(n);
+  Serial.print(F(" err "));
+  Serial.print(Comm::xact_errors);
+  Serial.print(F(" us last "));
+  Serial.print(Comm::xact_us_last);
+  Serial.print(F(" mean "));
+  Serial.print(n ? Comm::xact_us_total / n : 0);
+  Serial.print(F(" max "));
+  Serial.println(Comm::xact_us_max);
+  return false;
+}
+
+bool cmd_usart(uint8_t i)
+{
+  Serial.print(F("rx high "));
+  Serial.print(Comm::link.rx_high);
+  Serial.print(F(" frame "));
+  Serial.print(Comm::link.frame_errors);
+  Serial.print(F(" overrun events "));
+  Serial.print(Comm::link.hw_overruns);
+  Serial.print(F(" overflow bytes "));
+  Serial.println(Comm::link.rx_overflows);
+  return false;
+}
+
+// NOTE: shows the raw samples; estimating would keep idle channels awake
+bool cmd_tlm(uint8_t i)
+{
+  if (i == 0)
+  {
+    Serial.print(F("samples "));
+    Serial.print(Telemetry::samples);
+    Serial.print(F(" errors "));
+    Serial.println(Telemetry::errors);
+    return true;
+  }
+  Telemetry::Channel *p = &Telemetry::ch[i - 1];
+  Serial.print(F("ch "));
+  Serial.print(i - 1);
+  if (p->n)
+  {
+    Serial.print(F(" age ms "));
+    Serial.print(millis() - p->t[0]);
+    Serial.print(F(" x "));
+    Serial.println(p->x[0], 2);
+  }
+  else
+    Serial.println(F(" idle"));
+  return i < Telemetry::NUM_CH;
+}
+
+bool cmd_vm(uint8_t i)
+{
+  Serial.print(F("vm steps "));
+  Serial.print(VM::steps);
+  Serial.print(F(" max us "));
+  Serial.print(VM::step_us_max);
+  Serial.print(F(" fault pc "));
+  Serial.println(VM::fault_pc);
+  return false;
+}
+
+bool cmd_ctl(uint8_t i)
+{
+  if (i == 0)
+  {
+    unsigned long n = Control::intervals;
+    Serial.print(F("ctl Hz "));
+    Serial.print(Control::rate_x10() / 10.0, 1);
+    Serial.print(F(" jitter us mean "));
+    Serial.print(n ? Control::jitter_us_total / n : 0);
+    Serial.print(F(" max "));
+    Serial.print(Control::jitter_us_max);
+    Serial.print(F(" missed "));
+    Serial.println(Control::missed());
+    return true;
+  }
+  if (i == 1)
+  {
+    Serial.print(F("writes "));
+    Serial.print(Control::writes);
+    Serial.print(F(" coalesced "));
+    Serial.print(Control::coalesced);
+    Serial.print(F(" err "));
+    Serial.print(Control::write_errors);
+    Serial.print(F(" stale "));
+    Serial.println(Control::stale);
+    return true;
+  }
+  Control::Loop *l = &Control::loops[i - 2];
+  Serial.print(F("loop "));
+  Serial.print(i - 2);
+  if (l->active)
+  {
+    Serial.print(F(" sp "));
+    Serial.print(Fixed::q16_to_double(l->sp), 2);
+    Serial.print(F(" out "));
+    Serial.println(Fixed::q16_to_double(l->pid.out), 3);
+  }
+  else
+    Serial.println(F(" off"));
+  return i - 1 < Control::NUM_LOOPS;
+}
+
+bool cmd_wheel(uint8_t i)
+{
+  if (i == 0)
+  {
+    Serial.print(F("ms "));
+    Serial.print(millis());
+    Serial.print(F(" timers "));
+    Serial.println(Wheel::num_timers);
+    return Wheel::num_timers > 0;
+  }
+  Wheel::Timer *t = &Wheel::timers[i - 1];
+  Serial.print(F("tmr "));
+  Serial.print(i - 1);
+  Serial.print(F(" mode "));
+  Serial.print(t->mode);
+  if (t->armed)
+  {
+    Serial.print(F(" every ms "));
+    Serial.print(t->period);
+  }
+  else
+    Serial.print(F(" off"));
+  Serial.print(F(" runs "));
+  Serial.print(t->runs);
+  Serial.print(F(" over "));
+  Serial.println(t->overruns);
+  return i < Wheel::num_timers;
+}
+
+// reset the peak and error statistics, e.g. before a flight phase
+bool cmd_clear(uint8_t i)
+{
+  Comm::xact_us_max = 0;
+  Comm::xact_errors = 0;
+  Comm::xact_unwinds = Comm::resyncs = Comm::reconnects = 0;
+  Comm::link.rx_high = 0;
+  Comm::link.frame_errors = 0;
+  Comm::link.hw_overruns = 0;
+  Comm::link.rx_overflows = 0;
+  VM::step_us_max = 0;
+  Control::jitter_us_max = 0;
+  Control::write_errors = 0;
+  for (uint8_t t = 0; t < Wheel::num_timers; t++)
+    Wheel::timers[t].overruns = 0;
+  Serial.println(F("ok"));
+  return false;
+}
+
+// propose a verb/noun pair; KEY REL lights and the operator accepts it
+// on the keypad
+bool cmd_vn(uint8_t i)
+{
+  const long n = SysUtils::SysManager::NUM_VN;
+  if (argc != 2 || args[0] < 0 || args[0] >= n || args[1] < 0 ||
+      args[1] >= n)
+    Serial.println(F("? vn <verb> <noun>, 0 to 99"));
+  else
+  {
+    SysUtils::sys->request_vn(args[0], args[1]);
+    Serial.println(F("key release requested"));
+  }
+  return false;
+}
+
+bool cmd_unknown(uint8_t i)
+{
+  Serial.println(F("? try help"));
+  return false;
+}
+
+struct Command
+{
+  const char *name;
+  bool (*reply)(uint8_t i);
+};
+const Command commands[] = {
+    {"help", &cmd_help},
+    {"stat", &cmd_stat},
+    {"sup", &cmd_sup},
+    {"link", &cmd_link},
+    {"usart", &cmd_usart},
+    {"tlm", &cmd_tlm},
+    {"vm", &cmd_vm},
+    {"ctl", &cmd_ctl},
+    {"wheel", &cmd_wheel},
+    {"clear", &cmd_clear},
+    {"vn", &cmd_vn}};
+const uint8_t NUM_CMDS = sizeof(commands) / sizeof(commands[0]);
+const Command unknown = {"", &cmd_unknown};
+
+/* ===== line handling ===== */
+
+const Command *reply = NULL; // reply in progress
+uint8_t reply_i = 0;         // next line of the reply
+const Command *watch = NULL; // command repeated every CONSOLE_WATCH_MS
+unsigned long watch_at = 0;
+
+const Command *find(const char *name)
+{
+  for (uint8_t c = 0; c < NUM_CMDS; c++)
+    if (0 == strcmp(name, commands[c].name))
+      return &commands[c];
+  return &unknown;
+}
+
+// parse a command line and start its reply
+void execute(char *s)
+{
+  const char *name = strtok(s, " \t");
+  if (!name)
+    return;
+  bool repeat = 0 == strcmp(name, "watch");
+  if (repeat && !(name = strtok(NULL, " \t")))
+    name = "";
+  const Command *cmd = find(name);
+  argc = 0;
+  char *arg;
+  while (argc < 2 && (arg = strtok(NULL, " \t")))
+    args[argc++] = strtol(arg, NULL, 10);
+  if (repeat && cmd != &unknown)
+  {
+    watch = cmd;
+    watch_at = millis() + CONSOLE_WATCH_MS;
+  }
+  reply = cmd;
+  reply_i = 0;
+}
+
+// serve the console; call from the main loop
+// NOTE: verbs 38 and 74 have the port to themselves (script upload,
+//       recorder dump)
+void update()
+{
+  int v = SysUtils::sys->get_verb();
+  if (!SERIAL_ENABLE || v == 38 || v == 74)
+    return;
+  // one reply line at a time, into an empty TX buffer
+  if (reply)
+  {
+    if (Serial.availableForWrite() < SERIAL_TX_BUFFER_SIZE - 1)
+      return;
+    if (!reply->reply(reply_i++))
+      reply = NULL;
+    return;
+  }
+  while (Serial.available())
+  {
+    char c = Serial.read();
+    if (c == '\r' || c == '\n')
+    {
+      bool run = line_len && !line_over;
+      line[line_len] = '\0';
+      line_len = 0;
+      if (line_over)
+        reply = &unknown;
+      line_over = false;
+      if (run)
+        execute(line);
+      if (reply)
+        return; // rest of the input waits for the reply
+    }
+    else
+    {
+      watch = NULL; // typing stops a watch
+      if (line_len < CONSOLE_LINE_LEN)
+        line[line_len++] = c;
+      else
+        line_over = true;
+    }
+  }
+  if (watch && (long)(millis() - watch_at) >= 0)
+  {
+    reply = watch;
+    reply_i = 0;
+    watch_at = millis() + CONSOLE_WATCH_MS;
+  }
+}
+
+} // namespace Console
+
+#endif // CONSOLE_H
@@ -0,0 +1,241 @@
+/*
+ * Closed-loop control
+ * Fixed-rate PID loops on telemetry channels, driving kRPC controls:
+ * vertical speed hold on the throttle, and altitude hold on top of it
+ * NOTE: these are the only holds; there is no heading or TWR hold
+ * NOTE: the loops run from a W_DEFER timer wheel callback, i.e. from the
+ *       main loop, since kRPC calls can't run in an ISR
+ * NOTE: outputs are coalesced: a control gets at most one kRPC write per
+ *       period, and none while it moves less than CTL_DEADBAND
+ */
+
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include "base.h"
+#include "comm.hpp"
+#include "telemetry.hpp"
+#include "gains.hpp"
+#include "wheel.hpp"
+
+namespace Control
+{
+
+using namespace Fixed;
+
+const uint16_t PERIOD_MS = 1000 / CTL_RATE_HZ;
+const unsigned long PERIOD_US = PERIOD_MS * 1000UL;
+const q16_t DT = Q16_ONE / CTL_RATE_HZ; // period, in seconds
+
+/* ===== loop table ===== */
+
+enum loop_t // loops, stepped in this order (outer loops first)
+{
+  LOOP_ALT,  // altitude hold: drives the vertical speed setpoint
+  LOOP_VSPD, // vertical speed hold: drives the throttle
+  NUM_LOOPS
+};
+
+struct LoopDef
+{
+  uint8_t ch;   // process value: Telemetry::channel_t
+  int8_t inner; // loop whose setpoint the output drives, or -1
+  uint8_t ctl;  // otherwise the control it drives: Comm::control_t
+  Gains g;      // gains.hpp
+};
+const LoopDef defs[NUM_LOOPS] = {
+    {Telemetry::CH_ALT, LOOP_VSPD, 0, ALT_GAINS},
+    {Telemetry::CH_VSPD, -1, Comm::CTL_THROTTLE, VSPD_GAINS}};
+
+struct Loop
+{
+  bool active;
+  q16_t sp; // setpoint, in controller units
+  Pid pid;
+};
+Loop loops[NUM_LOOPS];
+
+// coalesced control outputs
+q16_t want[Comm::NUM_CTL]; // latest loop outputs
+q16_t sent[Comm::NUM_CTL]; // last values written
+uint8_t owned = 0;         // controls driven by a loop
+uint8_t sent_ok = 0;       // controls whose sent[] is valid
+
+/* ===== statistics ===== */
+
+int timer = -1;             // timer wheel callback, see init()
+unsigned long runs = 0;     // periods run
+unsigned long stale = 0;    // loop steps skipped on stale telemetry
+unsigned long writes = 0;   // kRPC control writes
+unsigned long coalesced = 0;    // writes saved by the deadband
+unsigned long write_errors = 0; // failed writes
+// periods measured: their count and the time they took, for the rate
+unsigned long intervals = 0;
+unsigned long elapsed_ms = 0;
+unsigned long last_run_ms;
+// period start jitter, i.e. |interval - PERIOD_US|
+unsigned long last_run_us = 0;
+unsigned long jitter_us_max = 0, jitter_us_total = 0;
+
+// periods skipped, main loop too late
+unsigned int missed()
+{
+  return timer >= 0 ? Wheel::timers[timer].overruns : 0;
+}
+
+// measured loop rate, in 0.1 Hz
+// NOTE: periods over elapsed time; early and late starts cancel out
+long rate_x10()
+{
+  if (!elapsed_ms)
+    return 0;
+  return 10000.0 * intervals / elapsed_ms + 0.5;
+}
+
+/* ===== runtime ===== */
+
+inline q16_t to_q16(float x)
+{
+  if (x >= 32767.0)
+    return Q16_MAX;
+  if (x <= -32768.0)
+    return Q16_MIN;
+  return q16_from_double(x);
+}
+
+// write the controls that moved
+void flush()
+{
+  for (uint8_t c = 0; c < Comm::NUM_CTL; c++)
+  {
+    if (!(owned & 1 << c))
+      continue;
+    if (sent_ok & 1 << c &&
+        q16_abs(q16_sub(want[c], sent[c])) < CTL_DEADBAND)
+    {
+      coalesced += 1;
+      continue;
+    }
+    if (0 == Comm::set_control(c, q16_to_double(want[c])))
+    {
+      sent[c] = want[c];
+      sent_ok |= 1 << c;
+      writes += 1;
+    }
+    else
+    {
+      sent_ok &= ~(1 << c); // write again next period
+      write_errors += 1;
+    }
+  }
+}
+
+// step the loops; runs every period while a hold is active
+// NOTE: a loop whose telemetry is stale holds its output
+void step()
+{
+  unsigned long t = micros(), tm = millis();
+  if (last_run_us)
+  {
+    unsigned long iv = t - last_run_us;
+    unsigned long j = iv > PERIOD_US ? iv - PERIOD_US : PERIOD_US - iv;
+    jitter_us_total += j;
+    if (j > jitter_us_max)
+      jitter_us_max = j;
+    elapsed_ms += tm - last_run_ms; // NOTE: sums to the exact span
+    intervals += 1;
+  }
+  last_run_us = t;
+  last_run_ms = tm;
+  runs += 1;
+  for (uint8_t i = 0; i < NUM_LOOPS; i++)
+  {
+    Loop *l = &loops[i];
+    const LoopDef *d = &defs[i];
+    float x;
+    if (!l->active)
+      continue;
+    if (!Telemetry::estimate(d->ch, millis(), &x))
+    {
+      stale += 1;
+      continue;
+    }
+    q16_t u = pid_step(&l->pid, l->sp, to_q16(x / d->g.unit), DT);
+    if (d->inner >= 0)
+      loops[d->inner].sp = u;
+    else
+      want[d->ctl] = u;
+  }
+  flush();
+}
+
+/* ===== holds ===== */
+
+// start loop i at setpoint sp (controller units), output starting at out
+void start(uint8_t i, q16_t sp, q16_t out)
+{
+  const LoopDef *d = &defs[i];
+  Loop *l = &loops[i];
+  pid_init(&l->pid, d->g);
+  pid_reset(&l->pid, out);
+  l->sp = sp;
+  l->active = true;
+  if (!Wheel::timers[timer].armed)
+  {
+    last_run_us = 0; // no interval to measure yet
+    Wheel::start(timer, PERIOD_MS, PERIOD_MS);
+  }
+  if (d->inner < 0)
+  {
+    owned |= 1 << d->ctl;
+    want[d->ctl] = l->pid.out;
+  }
+}
+
+// hold vertical speed vs (m/s) with the throttle; returns 0 on success,
+// -1 if the throttle can't be read
+// NOTE: takes over from the current throttle
+int hold_vspd(q16_t vs)
+{
+  float th;
+  if (0 != Comm::get_control(Comm::CTL_THROTTLE, &th))
+    return -1;
+  loops[LOOP_ALT].active = false;
+  start(LOOP_VSPD, vs, to_q16(th));
+  return 0;
+}
+
+// hold altitude alt (m) through the vertical speed loop; returns 0 on
+// success, -1 if the vertical speed or the throttle can't be read
+// NOTE: samples the vertical speed right away if its estimate is stale,
+//       e.g. on an idle channel; the altitude loop takes over from it
+int hold_alt(long alt)
+{
+  float vs;
+  if (!Telemetry::estimate(Telemetry::CH_VSPD, millis(), &vs) &&
+      0 != Telemetry::sample(Telemetry::CH_VSPD, &vs))
+    return -1;
+  if (0 != hold_vspd(to_q16(vs)))
+    return -1;
+  start(LOOP_ALT, q16_from_ratio(alt, defs[LOOP_ALT].g.unit), to_q16(vs));
+  return 0;
+}
+
+// stop all holds; the controls stay where the loops left them
+void release()
+{
+  for (uint8_t i = 0; i < NUM_LOOPS; i++)
+    loops[i].active = false;
+  owned = sent_ok = 0;
+  Wheel::stop(timer);
+}
+
+// register the loop timer; call once before timer_init()
+void init()
+{
+  timer = Wheel::add(&step, Wheel::W_DEFER);
+}
+
+} // namespace Control
+
+#endif // CONTROL_H
@@ -8,10 +8,11 @@
 
 #include "base.h"
 #include "system.hpp"
+#include "fixed.hpp"
+#include "fastpin.hpp"
+#include "keypad.hpp"
 
 // hardware libs
-#include <Key.h>
-#include <Keypad.h> // parallel
 #include "LedControl.h"
 
 namespace Devices
@@ -19,78 +20,272 @@ namespace Devices
 
 /* ===== interrupt-based keypad class ===== */
 
+// port of the key matrix
+const uint16_t KEYPAD_PORT = FastIO::PIN_PORT[KEYPAD_ROW_PINS[0]];
+
+// keys of column C down in rows R and up, from the port input bits
+// NOTE: templates s.t. the scan unrolls with every mask a constant
+template <uint8_t C, uint8_t R = 0>
+struct KeypadRow
+{
+  static const uint8_t MASK = FastIO::pin_mask(KEYPAD_ROW_PINS[R]);
+  static inline uint16_t keys(uint8_t rows)
+  {
+    return (rows & MASK ? 1 << (R * KEYPAD_COLS + C) : 0) |
+           KeypadRow<C, R + 1>::keys(rows);
+  }
+};
+template <uint8_t C>
+struct KeypadRow<C, KEYPAD_ROWS>
+{
+  static inline uint16_t keys(uint8_t) { return 0; }
+};
+
+// keys down in columns C and up: drive each column low in turn and read
+// the rows through their pull-ups
+template <uint8_t C = 0>
+struct KeypadCol
+{
+  typedef FastIO::FastPort<KEYPAD_PORT> Port;
+  static const uint8_t MASK = FastIO::pin_mask(KEYPAD_COL_PINS[C]);
+  static inline uint16_t scan()
+  {
+    Port::ddr() |= MASK; // drive the column low
+    delayMicroseconds(KEYPAD_SETTLE_US);
+    uint8_t rows = ~Port::in();
+    Port::ddr() &= ~MASK; // release it
+    return KeypadRow<C>::keys(rows) | KeypadCol<C + 1>::scan();
+  }
+};
+template <>
+struct KeypadCol<KEYPAD_COLS>
+{
+  static inline uint16_t scan() { return 0; }
+};
+
+// hold and repeat periods, in scans
+const uint16_t KEYPAD_HOLD_TICKS = (long)KEYPAD_HOLD_MS * INT_FREQ_2 / 1000;
+const uint16_t KEYPAD_REPEAT_TICKS = (long)KEYPAD_REPEAT_MS * INT_FREQ_2 / 1000;
+
+// key matrix scanner with per-key debouncing and an event queue
+// NOTE: columns are driven low one at a time and the rows read through
+//       their pull-ups, so any number of keys may be down at once
+// NOTE: key index is row * KEYPAD_COLS + col; debouncing, hold/repeat
+//       and the queue are KeyEvents (keypad.hpp)
 class Keypad_I
+    : public KeyEvents<KEYPAD_ROWS * KEYPAD_COLS, KEYPAD_HOLD_TICKS,
+                       KEYPAD_REPEAT_TICKS, KEYPAD_QUEUE_LEN>
 {
 private:
-  Keypad *kpd; // instance of the basic non-blocking Keypad class
-  char k;      // key buffer
-  bool k_read; // set true to enable key buffer update
+  static const int NUM_KEYS = KEYPAD_ROWS * KEYPAD_COLS;
+
+  // read the raw matrix; bit set if the key is down
+  uint16_t scan()
+  {
+    return KeypadCol<>::scan();
+  }
+
 public:
   Keypad_I()
   {
-    kpd = new Keypad(makeKeymap(KEYPAD_KEYS), KEYPAD_ROW_PINS,
-                     KEYPAD_COL_PINS, KEYPAD_ROWS, KEYPAD_COLS);
-    k = 0;
-    k_read = true; // ready to be updated
+    static_assert(
+        FastIO::on_port(KEYPAD_ROW_PINS, KEYPAD_ROWS, KEYPAD_PORT) &&
+            FastIO::on_port(KEYPAD_COL_PINS, KEYPAD_COLS, KEYPAD_PORT),
+        "keypad pins must share a port");
+    for (int r = 0; r < KEYPAD_ROWS; r++)
+      pinMode(KEYPAD_ROW_PINS[r], INPUT_PULLUP);
+    for (int c = 0; c < KEYPAD_COLS; c++)
+      pinMode(KEYPAD_COL_PINS[c], INPUT); // NOTE: also clears the PORT bit
+    for (int i = 0; i < NUM_KEYS; i++)
+    {
+      char k = KEYPAD_KEYS[i / KEYPAD_COLS][i % KEYPAD_COLS];
+      if (k == M_UP_KEY || k == M_DOWN_KEY)
+        repeat_mask_ |= 1 << i;
+    }
+  }
+  // the key of an event
+  char eventKey(uint8_t ev)
+  {
+    int i = ev & 0x0F;
+    return KEYPAD_KEYS[i / KEYPAD_COLS][i % KEYPAD_COLS];
   }
-  // get the key stored in the key buffer and set ready for update
-  // NOTE: should be called by the UI
+  // get the next pressed (or repeating) key; 0 if none
+  // NOTE: should be called by the UI; drops the other events
   char getKeyEvent()
   {
-    if (!k_read) // key has not been read by another program
-    {
-      k_read = true;
-      return k;
-    }
-    else //  another program has already read the key (no new key event)
-      return 0;
+    uint8_t ev;
+    while ((ev = getEvent()))
+      if ((ev & 0xF0) == KEY_PRESS || (ev & 0xF0) == KEY_REPEAT)
+        return eventKey(ev);
+    return 0;
   }
-  // update the key buffer
-  // NOTE: should be called by a timer interrupt
+  // scan, debounce and queue events
+  // NOTE: should be called by a W_ISR timer callback at INT_FREQ_2
   void ISRUpdate()
   {
-    char k_temp = kpd->getKey();
-    if (k_read && k_temp != 0) // key has been read, enable key update
-    {                          // NOTE: only update if k != 0
-      k = k_temp;              // register key event
-      k_read = false;
-    }
+    update(scan());
   }
 };
 Keypad_I *keypad; // pointer to a keypad instance
 
 /* ===== display helper classes ===== */
 
+// display layers, lowest priority first
+// NOTE: each layer has its own copy of every row; a digit shows the
+//       topmost layer that has drawn it, so writers never clobber each other
+enum lc_layer_t
+{
+  L_SYS,  // system (p/v/n row)
+  L_PGM,  // background program
+  L_VERB, // foreground verb
+  L_IW,   // input window
+  NUM_LAYERS
+};
+const uint8_t LC_ROW_MASK = (1 << LC_ROW_LEN) - 1; // all digits opaque
+
 class LC_Display
 {
 private:
-  LedControl *lc;       // instance of the LedControl driver class
-  typedef struct LC_BUF // struct for display buffers
-  {
-    bool update = true;                   // update flag
-    bool flash = false;                   // flashing flag
-    char c_buf[LC_ROW_LEN * 2] = {0};     // row buffer
-    bool char_mask[LC_ROW_LEN] = {false}; // clear mask to allow update
-    bool dot_buf[LC_ROW_LEN] = {false};   // set to display dots
-  } LC_BUF;
-  LC_BUF lc_buf[NUM_LC]; // main display buffer
-  bool flash_toggle;     // screen flash control flag
-  long last_millis;      // buffer for monitoring flash period
+  typedef struct LC_ROW // one row of one layer
+  {
+    char c_buf[LC_ROW_LEN + 1]; // row buffer (+1 for snprintf's '\0')
+    bool dot_buf[LC_ROW_LEN];   // set to display dots
+    uint8_t mask;               // opaque digits, bit i is c_buf[i]
+    bool flash;                 // flashing flag
+  } LC_ROW;
+  typedef struct LC_OUT // one physical row
+  {
+    LedControl *lc; // driver of the chain the row is on
+    uint8_t dev;    // device index on that chain
+    // framebuffer: what the MAX7219 shows, as char | dot << 7
+    uint8_t shown[LC_ROW_LEN];
+    bool flash;
+    volatile bool dirty; // row needs re-compositing
+  } LC_OUT;
+  int num_rows;      // rows over all chains
+  LC_ROW *layers;    // layer buffers, NUM_LAYERS blocks of num_rows
+  LC_OUT *out;       // physical rows
+  LC_ROW row;        // staging row for the setters
+  int layer;         // layer the setters draw on
+  bool flash_toggle; // screen flash control flag
+  long last_millis;  // buffer for monitoring flash period
+
+  LC_ROW *at(int l, int addr)
+  {
+    return layers + l * num_rows + addr;
+  }
+  // copy a row of the current layer to the staging row for editing
+  LC_ROW *edit(int addr)
+  {
+    if (addr < 0 || addr >= num_rows)
+      memset(&row, 0, sizeof(LC_ROW)); // scratch; commit() drops it
+    else
+      row = *at(layer, addr);
+    return &row;
+  }
+  // store the staging row, marking digits in mask opaque
+  // NOTE: only a row that actually changed is re-composited
+  // NOTE: the ISR may read a half-copied row; dirty is set after the copy,
+  //       so the next frame corrects it
+  void commit(int addr, uint8_t mask)
+  {
+    if (addr < 0 || addr >= num_rows)
+      return; // e.g. an extended page on a display without the rows
+    row.mask |= mask;
+    if (0 == memcmp(at(layer, addr), &row, sizeof(LC_ROW)))
+      return;
+    *at(layer, addr) = row;
+    out[addr].dirty = true;
+  }
+  // merge the layers of a row and send the digits that changed
+  // NOTE: only the row's own chain is shifted
+  void composite(int addr)
+  {
+    LC_OUT *o = out + addr;
+    int top = -1; // topmost layer with opaque digits, for flashing
+    for (int i = 0; i < LC_ROW_LEN; i++)
+    {
+      char c = ' ';
+      bool dot = false;
+      for (int l = NUM_LAYERS - 1; l >= 0; l--)
+        if (at(l, addr)->mask & (1 << i))
+        {
+          c = at(l, addr)->c_buf[i];
+          dot = at(l, addr)->dot_buf[i];
+          top = l > top ? l : top;
+          break;
+        }
+      uint8_t code = (c & 0x7F) | (dot ? 0x80 : 0);
+      if (code == o->shown[i])
+        continue; // NOTE: SPI is the slow part; skip unchanged digits
+      o->shown[i] = code;
+      o->lc->setChar(o->dev, LC_ROW_LEN - 1 - i, c, dot);
+      // NOTE: above -- setting dp to false does not prevent printing '.'
+    }
+    bool flash = top >= 0 && at(top, addr)->flash;
+    if (flash != o->flash)
+    {
+      o->flash = flash;
+      if (!flash)
+        o->lc->shutdown(o->dev, false); // ensure display is on
+    }
+  }
 
 public:
-  // TODO: allow the user to specify number of rows; need dynamic alloc
-  LC_Display()
+  // chain_rows: number of rows (MAX7219s) on each chain in LC_CS_PINS
+  // NOTE: rows are numbered through the chains in order; falls back to
+  //       NUM_LC rows on the first chain if fewer are configured, since
+  //       the p/v/n row and three data rows are assumed everywhere
+  LC_Display(const uint8_t *chain_rows)
   {
-    lc = new LedControl(LC_CS, NUM_LC);
-    flash_toggle = true;
-    last_millis = 0;
-    for (int i = 0; i < NUM_LC; i++)
+    num_rows = 0;
+    for (int c = 0; c < LC_MAX_CHAINS; c++)
+      num_rows += chain_rows[c] < LC_CHAIN_LEN ? chain_rows[c] : LC_CHAIN_LEN;
+    bool fallback = num_rows < NUM_LC;
+    if (fallback)
+      num_rows = NUM_LC;
+    layers = (LC_ROW *)calloc(NUM_LAYERS * num_rows, sizeof(LC_ROW));
+    out = (LC_OUT *)calloc(num_rows, sizeof(LC_OUT));
+    int addr = 0;
+    for (int c = 0; c < LC_MAX_CHAINS; c++)
     {
-      lc->shutdown(i, false);
-      lc->setIntensity(i, LC_LUM);
-      lc->clearDisplay(i);
-      clear(i);
+      int n = fallback ? (c == 0 ? NUM_LC : 0) : chain_rows[c];
+      n = n < LC_CHAIN_LEN ? n : LC_CHAIN_LEN;
+      if (n == 0)
+        continue;
+      LedControl *lc = new LedControl(LC_CS_PINS[c], n); // clears devices
+      lc->setIntensityAll(LC_LUM);
+      lc->shutdownAll(false);
+      for (int d = 0; d < n; d++, addr++)
+      {
+        out[addr].lc = lc;
+        out[addr].dev = d;
+      } // NOTE: shown[] is zeroed, which forces a full first frame
     }
+    flash_toggle = true;
+    last_millis = 0;
+    for (layer = 0; layer < NUM_LAYERS; layer++)
+      for (int i = 0; i < num_rows; i++)
+      {
+        clear(i);
+        release(i);
+      }
+    layer = L_SYS;
+  }
+
+  // number of rows over all chains
+  int rows()
+  {
+    return num_rows;
+  }
+
+  // select the layer the setters draw on; returns the previous layer
+  // NOTE: the system manager selects the layer of whoever it runs
+  int setLayer(int l)
+  {
+    int prev = layer;
+    layer = l;
+    return prev;
   }
 
   // print a string to the specified position on display
@@ -98,60 +293,84 @@ public:
                 bool *char_mask, bool *dot_buf)
   {
     len = (offset + len > LC_ROW_LEN) ? LC_ROW_LEN - offset : len;
+    LC_ROW *r = edit(addr);
+    uint8_t mask = 0;
     for (int i = 0; i < len; i++)
     {
       if (char_mask && char_mask[i])
         continue; // if mask set, skip updating current position
-      int idx = LC_ROW_LEN - 1 - (i + offset);
-      lc->setChar(addr, idx, buf[i], dot_buf ? dot_buf[i] : false);
-      // NOTE: above -- setting dp to false does not prevent printing '.'
+      r->c_buf[i + offset] = buf[i];
+      r->dot_buf[i + offset] = dot_buf ? dot_buf[i] : false;
+      mask |= 1 << (i + offset);
     }
-  }
-  // print a row from the display buffer
-  void update(int addr)
-  {
-    printStr(addr, lc_buf[addr].c_buf, 0, LC_ROW_LEN,
-             lc_buf[addr].char_mask, lc_buf[addr].dot_buf);
-    if (lc_buf[addr].flash) // toggle display if flashing
-      lc->shutdown(addr, flash_toggle);
+    commit(addr, mask);
   }
   // update the entire display
   // NOTE: call this from a screen update ISR
   void ISRUpdate()
   {
-    // update main display from buffer
-    for (int i = 0; i < NUM_LC; i++)
-      if (lc_buf[i].update)
-        update(i);
+    // re-composite rows whose layers changed
+    for (int i = 0; i < num_rows; i++)
+      if (out[i].dirty)
+      {
+        out[i].dirty = false;
+        composite(i);
+      }
     // flip flash toggle
     long curr_millis = millis();
     if (curr_millis - last_millis > LC_FLASH_DELAY)
     {
       last_millis = curr_millis;
       flash_toggle = flash_toggle ? false : true;
+      for (int i = 0; i < num_rows; i++)
+        if (out[i].flash) // toggle display if flashing
+          out[i].lc->shutdown(out[i].dev, flash_toggle);
     }
   }
 
   // clear the display buffer of a row
+  // NOTE: the row stays opaque, i.e. it hides the layers below
   void clear(int addr)
   {
-    memset(lc_buf[addr].c_buf, ' ', LC_ROW_LEN);
-    memset(lc_buf[addr].dot_buf, false, LC_ROW_LEN);
+    LC_ROW *r = edit(addr);
+    memset(r->c_buf, ' ', LC_ROW_LEN);
+    memset(r->dot_buf, false, LC_ROW_LEN);
+    commit(addr, LC_ROW_MASK);
   }
-  // clear all data rows
+  // clear all data rows, and stop them flashing
   void clearDataRows()
   {
-    for (int i = 1; i < NUM_LC; i++)
+    for (int i = 1; i < num_rows; i++)
+    {
       clear(i);
+      setFlash(i, false);
+    }
+  }
+  // make a row transparent, showing the layers below
+  void release(int addr)
+  {
+    LC_ROW *r = edit(addr);
+    r->mask = 0;
+    r->flash = false;
+    commit(addr, 0);
+  }
+  // make every row of a layer transparent
+  void releaseLayer(int l)
+  {
+    int prev = setLayer(l);
+    for (int i = 0; i < num_rows; i++)
+      release(i);
+    setLayer(prev);
   }
 
   // write formatted numbers to display buffers
   void setDouble(int addr, double num)
   {
+    LC_ROW *r = edit(addr);
     // print the sign
     // NOTE: if num in (-1,1), put the dot directly after the sign
-    lc_buf[addr].c_buf[0] = (num >= 0) ? ' ' : '-';
-    lc_buf[addr].dot_buf[0] = (num < 1 && num > -1) ? true : false;
+    r->c_buf[0] = (num >= 0) ? ' ' : '-';
+    r->dot_buf[0] = (num < 1 && num > -1) ? true : false;
     num = num >= 0 ? num : -num; // flip to print the abs
 
     // print the rest of the number using a string buffer
@@ -163,23 +382,43 @@ public:
     while (digits_printed < LC_ROW_LEN)
     {
       bool print_dot = buf_i + 1 < strlen(buf) && buf[buf_i + 1] == '.';
-      lc_buf[addr].dot_buf[digits_printed] = print_dot;
-      lc_buf[addr].c_buf[digits_printed] = buf[buf_i];
+      r->dot_buf[digits_printed] = print_dot;
+      r->c_buf[digits_printed] = buf[buf_i];
 
       digits_printed += 1;
       buf_i += print_dot ? 2 : 1;
     }
+    commit(addr, LC_ROW_MASK);
   }
-  void setInt(int addr, long num)
+  // NOTE: integer-only replacements for setDouble(), see fixed.hpp
+  void setFixed(int addr, Fixed::q16_t num)
   {
-    lc_buf[addr].c_buf[0] = (num >= 0) ? ' ' : '-';
+    LC_ROW *r = edit(addr);
+    Fixed::q16_format(num, r->c_buf, r->dot_buf, LC_ROW_LEN);
+    commit(addr, LC_ROW_MASK);
+  }
+  // print num / 10^dp with dp decimals, zero-padded like setInt()
+  void setScaled(int addr, long num, int dp)
+  {
+    LC_ROW *r = edit(addr);
+    r->c_buf[0] = (num >= 0) ? ' ' : '-';
     num = num >= 0 ? num : -num; // flip to print the abs
-    snprintf(lc_buf[addr].c_buf + 1, LC_ROW_LEN, "%07ld", num);
+    snprintf(r->c_buf + 1, LC_ROW_LEN, "%07ld", num);
+    memset(r->dot_buf, false, LC_ROW_LEN);
+    if (dp > 0 && dp < LC_ROW_LEN)
+      r->dot_buf[LC_ROW_LEN - 1 - dp] = true;
+    commit(addr, LC_ROW_MASK);
+  }
+  void setInt(int addr, long num)
+  {
+    setScaled(addr, num, 0);
   }
   void setUL(int addr, unsigned long num, bool hex)
   {
-    snprintf(lc_buf[addr].c_buf, LC_ROW_LEN + 1,
-             (hex ? "%08lx" : "%08lu"), num);
+    LC_ROW *r = edit(addr);
+    snprintf(r->c_buf, LC_ROW_LEN + 1, (hex ? "%08lx" : "%08lu"), num);
+    memset(r->dot_buf, false, LC_ROW_LEN);
+    commit(addr, LC_ROW_MASK);
   }
   void setUL(int addr, uint16_t num)
   {
@@ -190,6 +429,7 @@ public:
   // NOTE: requires arrays of size 3
   void setPVN(int addr, int *pgm_buf)
   {
+    LC_ROW *r = edit(addr);
     for (int i = 0; i < 3; i++)
     {
       char buf[3];
@@ -197,45 +437,91 @@ public:
         sprintf(buf, "--");
       else
         sprintf(buf, "%02.2d", pgm_buf[i]);
-      memcpy(lc_buf[addr].c_buf + i * 3, buf, 2);
+      memcpy(r->c_buf + i * 3, buf, 2);
     }
+    commit(addr, LC_ROW_MASK);
   }
 
   // set the flashing flag for a row
   void setFlash(int addr, bool enable)
   {
-    if (enable)
-      lc_buf[addr].flash = true;
-    else
-    {
-      lc_buf[addr].flash = false;
-      lc->shutdown(addr, false); // ensure display is on
-    }
+    LC_ROW *r = edit(addr);
+    r->flash = enable;
+    commit(addr, 0); // NOTE: no-op if unchanged; telemetry calls per frame
   }
+};
+LC_Display *lcd; // LED Control Display :/
+
+/* ===== status lights ===== */
 
-  // freeze/unfreeze rows
-  void setUpdate(int addr, bool update)
+// LED pins grouped by port at compile time, s.t. a group is written at
+// once with no table lookups
+// NOTE: templates unroll over the LEDs; G is the first LED of a group
+constexpr uint16_t led_port(uint8_t i)
+{
+  return FastIO::PIN_PORT[LED_PINS[i]];
+}
+// whether LED i is the first on its port, looking from LED j on
+constexpr bool led_group_head(uint8_t i, uint8_t j = 0)
+{
+  return j == i || (led_port(j) != led_port(i) && led_group_head(i, j + 1));
+}
+
+// pins of group G for the LEDs in leds (bit i is LED i), from LED I on
+template <uint8_t G, uint8_t I = 0>
+struct LedPins
+{
+  static const uint8_t MASK =
+      led_port(I) == led_port(G) ? FastIO::pin_mask(LED_PINS[I]) : 0;
+  static inline uint8_t pins(uint8_t leds)
   {
-    lc_buf[addr].update = update;
+    return (leds & 1 << I ? MASK : 0) | LedPins<G, I + 1>::pins(leds);
   }
-  void setUpdateAll(bool update)
+};
+template <uint8_t G>
+struct LedPins<G, NUM_LED>
+{
+  static inline uint8_t pins(uint8_t) { return 0; }
+};
+
+// switch the LEDs in on and off, one store per port, from LED G on
+template <uint8_t G = 0>
+struct LedGroups
+{
+  typedef FastIO::FastPort<led_port(G)> Port;
+  static const bool HEAD = led_group_head(G);
+  static inline void write(uint8_t on, uint8_t off)
   {
-    for (int i = 1; i < NUM_LC; i++)
-      lc_buf[i].update = update;
+    if (HEAD)
+    {
+      uint8_t set = LedPins<G>::pins(on), clr = LedPins<G>::pins(off);
+      if (set | clr)
+        Port::out() = (Port::out() & ~clr) | set;
+    }
+    LedGroups<G + 1>::write(on, off);
   }
 };
-LC_Display *lcd; // LED Control Display :/
-
-/* ===== status lights ===== */
+template <>
+struct LedGroups<NUM_LED>
+{
+  static inline void write(uint8_t, uint8_t) {}
+};
 
 class StatusDisplay
 {
 private:
-  bool led_status_[NUM_LED] = {0};
+  // LED state, bit i is LED i (LED_PINS_P)
+  // NOTE: written by the main loop, read by the ISR; a blink only changes
+  //       what the ISR shows, so nothing has to poll it
+  volatile uint8_t on_ = 0;    // lit (steady or blinking)
+  volatile uint8_t blink_ = 0; // blinking
+  volatile uint8_t phase_ = 0; // blinking in anti-phase
+  uint8_t shown_ = 0;          // state of the pins after the last update
 
 public:
   StatusDisplay()
   {
+    static_assert(NUM_LED <= 8, "LED masks are 8 bits wide");
     pinMode(LED_ACT, OUTPUT); // activity LED
     for (int i = 0; i < NUM_LED; i++)
     {
@@ -243,30 +529,55 @@ public:
       digitalWrite(LED_PINS[i], LOW);
     }
   }
-  // set an individual LED
+  // set an individual LED (steady)
   void setStatus(int addr, bool enable)
   {
     if (addr < 0 || addr >= NUM_LED)
       return;
-    led_status_[addr] = enable;
+    uint8_t bit = 1 << addr;
+    blink_ &= ~bit;
+    on_ = enable ? on_ | bit : on_ & ~bit;
+  }
+  // blink an individual LED at the LC_FLASH_DELAY rate
+  // NOTE: anti_phase LEDs are lit while the others are dark
+  void setBlink(int addr, bool anti_phase = false)
+  {
+    if (addr < 0 || addr >= NUM_LED)
+      return;
+    uint8_t bit = 1 << addr;
+    phase_ = anti_phase ? phase_ | bit : phase_ & ~bit;
+    blink_ |= bit;
+    on_ |= bit;
   }
   // clear all status LEDs
   void clear()
   {
-    for (int i = 0; i < NUM_LED; i++)
-      led_status_[i] = false;
+    on_ = 0;
+    blink_ = 0;
   }
   // clear error LEDs
   void clearError()
   {
-    led_status_[LED_PGER_P] = false;
-    led_status_[LED_OPER_P] = false;
+    uint8_t bits = 1 << LED_PGER_P | 1 << LED_OPER_P;
+    on_ &= ~bits;
+    blink_ &= ~bits;
   }
   // call from ISR
+  // NOTE: only writes pins whose state changed, one store per port
   void ISRUpdate()
   {
-    for (int i = 0; i < NUM_LED; i++)
-      digitalWrite(LED_PINS[i], led_status_[i] ? HIGH : LOW);
+    // NOTE: blink phase counts LC_FLASH_DELAY periods, not ISR ticks,
+    //       since the ISR rate follows the display refresh rate
+    uint8_t dark = (millis() / LC_FLASH_DELAY) & 1 ? ~phase_ : phase_;
+    uint8_t lit = on_ & ~(blink_ & dark);
+    uint8_t changed = lit ^ shown_;
+    if (!changed)
+      return;
+    uint8_t sreg = SREG;
+    cli(); // NOTE: the high ports take a read-modify-write
+    LedGroups<>::write(changed & lit, changed & ~lit);
+    SREG = sreg;
+    shown_ = lit;
   }
   void setActivityLED(bool enable)
   {
@@ -0,0 +1,210 @@
+/*
+ * Fast GPIO
+ * Pin to port/mask resolution at compile time, for the hot paths in ISRs
+ * NOTE: digitalWrite() looks the pin up in three flash tables and saves
+ *       and restores SREG on every call; FastPin<N> compiles to a single
+ *       sbi/cbi for ports A to G
+ * NOTE: pin numbers follow the Arduino Mega2560 layout
+ * NOTE: FastPort<P> gives the registers of a whole port, for pins that are
+ *       written or read as a group (status LEDs, keypad matrix)
+ * NOTE: templates and inline code only, so the driver libraries can
+ *       include it as well
+ */
+
+#ifndef FASTPIN_H
+#define FASTPIN_H
+
+#include <Arduino.h>
+
+namespace FastIO
+{
+
+/* ===== ATmega2560 pin map ===== */
+
+// data space address of each port's PINx; DDRx and PORTx follow it
+// NOTE: sbi/cbi only reach I/O addresses below 0x20 (data space 0x40),
+//       i.e. ports A to G; H to L need a load-modify-store
+const uint16_t P_A = 0x20, P_B = 0x23, P_C = 0x26, P_D = 0x29,
+               P_E = 0x2C, P_F = 0x2F, P_G = 0x32, P_H = 0x100,
+               P_J = 0x103, P_K = 0x106, P_L = 0x109;
+const uint8_t NUM_PINS = 70;
+
+// port and bit of each Arduino pin, as in the Mega's pins_arduino.h
+constexpr uint16_t PIN_PORT[NUM_PINS] = {
+    P_E, P_E, P_E, P_E, P_G, P_E, P_H, P_H, // 0-7
+    P_H, P_H, P_B, P_B, P_B, P_B, P_J, P_J, // 8-15
+    P_H, P_H, P_D, P_D, P_D, P_D, P_A, P_A, // 16-23
+    P_A, P_A, P_A, P_A, P_A, P_A, P_C, P_C, // 24-31
+    P_C, P_C, P_C, P_C, P_C, P_C, P_D, P_G, // 32-39
+    P_G, P_G, P_L, P_L, P_L, P_L, P_L, P_L, // 40-47
+    P_L, P_L, P_B, P_B, P_B, P_B, P_F, P_F, // 48-55
+    P_F, P_F, P_F, P_F, P_F, P_F, P_K, P_K, // 56-63 (A0-A9)
+    P_K, P_K, P_K, P_K, P_K, P_K};          // 64-69 (A10-A15)
+constexpr uint8_t PIN_BIT[NUM_PINS] = {
+    0, 1, 4, 5, 5, 3, 3, 4, // 0-7
+    5, 6, 4, 5, 6, 7, 1, 0, // 8-15
+    1, 0, 3, 2, 1, 0, 0, 1, // 16-23
+    2, 3, 4, 5, 6, 7, 7, 6, // 24-31
+    5, 4, 3, 2, 1, 0, 7, 2, // 32-39
+    1, 0, 7, 6, 5, 4, 3, 2, // 40-47
+    1, 0, 3, 2, 1, 0, 0, 1, // 48-55
+    2, 3, 4, 5, 6, 7, 0, 1, // 56-63
+    2, 3, 4, 5, 6, 7};      // 64-69
+
+/* ===== compile-time pins ===== */
+
+#ifdef __AVR__
+template <uint8_t N>
+class FastPin
+{
+  static_assert(N < NUM_PINS, "not a Mega2560 pin");
+
+private:
+  static volatile uint8_t &reg(uint16_t addr)
+  {
+    return *(volatile uint8_t *)addr;
+  }
+  // set/clear bits of a port register
+  // NOTE: the high ports take an interrupt-safe read-modify-write
+  static inline void modify(uint16_t addr, bool on)
+  {
+    const uint8_t mask = 1 << PIN_BIT[N];
+    if (PIN_PORT[N] + 2 < 0x40) // constant-folded; one sbi/cbi
+    {
+      if (on)
+        reg(addr) |= mask;
+      else
+        reg(addr) &= ~mask;
+      return;
+    }
+    uint8_t sreg = SREG;
+    cli();
+    if (on)
+      reg(addr) |= mask;
+    else
+      reg(addr) &= ~mask;
+    SREG = sreg;
+  }
+
+public:
+  static inline void set() { modify(PIN_PORT[N] + 2, true); }
+  static inline void clear() { modify(PIN_PORT[N] + 2, false); }
+  static inline void write(bool on) { modify(PIN_PORT[N] + 2, on); }
+  // NOTE: writing a one to PINx toggles the bit; atomic on every port
+  static inline void toggle() { reg(PIN_PORT[N]) = 1 << PIN_BIT[N]; }
+  static inline bool read()
+  {
+    return reg(PIN_PORT[N]) & (1 << PIN_BIT[N]);
+  }
+  static inline void output() { modify(PIN_PORT[N] + 1, true); }
+  static inline void input() // floating
+  {
+    modify(PIN_PORT[N] + 1, false);
+    modify(PIN_PORT[N] + 2, false);
+  }
+  static inline void pullup()
+  {
+    modify(PIN_PORT[N] + 1, false);
+    modify(PIN_PORT[N] + 2, true);
+  }
+};
+#else // NOTE: off-target builds fall back to the Arduino calls
+template <uint8_t N>
+class FastPin
+{
+public:
+  static inline void set() { digitalWrite(N, HIGH); }
+  static inline void clear() { digitalWrite(N, LOW); }
+  static inline void write(bool on) { digitalWrite(N, on ? HIGH : LOW); }
+  static inline void toggle() { digitalWrite(N, !digitalRead(N)); }
+  static inline bool read() { return digitalRead(N); }
+  static inline void output() { pinMode(N, OUTPUT); }
+  static inline void input() { pinMode(N, INPUT); }
+  static inline void pullup() { pinMode(N, INPUT_PULLUP); }
+};
+#endif
+
+/* ===== compile-time ports ===== */
+
+// whether pins[0..n) are all on port
+constexpr bool on_port(const uint8_t *pins, uint8_t n, uint16_t port)
+{
+  return !n || (PIN_PORT[pins[0]] == port && on_port(pins + 1, n - 1, port));
+}
+
+// mask of a pin in its port
+constexpr uint8_t pin_mask(uint8_t pin)
+{
+  return 1 << PIN_BIT[pin];
+}
+
+#ifdef __AVR__
+// the registers of port P (P_A to P_L)
+template <uint16_t P>
+class FastPort
+{
+public:
+  static inline volatile uint8_t &in() { return *(volatile uint8_t *)P; }
+  static inline volatile uint8_t &ddr()
+  {
+    return *(volatile uint8_t *)(P + 1);
+  }
+  static inline volatile uint8_t &out()
+  {
+    return *(volatile uint8_t *)(P + 2);
+  }
+};
+#else // NOTE: off-target builds get a plain byte per register
+template <uint16_t P>
+class FastPort
+{
+public:
+  static inline volatile uint8_t &in()
+  {
+    static volatile uint8_t r;
+    return r;
+  }
+  static inline volatile uint8_t &ddr()
+  {
+    static volatile uint8_t r;
+    return r;
+  }
+  static inline volatile uint8_t &out()
+  {
+    static volatile uint8_t r;
+    return r;
+  }
+};
+#endif
+
+/* ===== run-time pins ===== */
+
+// a pin only known at run time, resolved to its port and mask once
+// NOTE: for pins taken from a table, e.g. per-chain chip selects
+class PinRef
+{
+private:
+  volatile uint8_t *port_;
+  uint8_t mask_;
+
+public:
+  void attach(uint8_t pin)
+  {
+    port_ = portOutputRegister(digitalPinToPort(pin));
+    mask_ = digitalPinToBitMask(pin);
+  }
+  inline void write(bool on)
+  {
+    uint8_t sreg = SREG;
+    cli();
+    if (on)
+      *port_ |= mask_;
+    else
+      *port_ &= ~mask_;
+    SREG = sreg;
+  }
+};
+
+} // namespace FastIO
+
+#endif // FASTPIN_H
@@ -0,0 +1,370 @@
+/*
+ * Fixed-point math
+ * Q16.16 and Q32.32 types for display, input and flight math
+ * NOTE: the Mega has no FPU and double is 32-bit soft-float; these only use
+ *       integer arithmetic and don't depend on Arduino headers
+ * NOTE: host accuracy tests: test/fixed_test.cpp
+ */
+
+#ifndef FIXED_H
+#define FIXED_H
+
+#include <stdint.h>
+
+#ifdef __AVR__
+#include <avr/pgmspace.h>
+#define FIXED_PROGMEM PROGMEM
+#define FIXED_READ_TABLE(p) ((int32_t)pgm_read_dword(p))
+#else
+#define FIXED_PROGMEM
+#define FIXED_READ_TABLE(p) (*(p))
+#endif
+
+namespace Fixed
+{
+
+/* ===== types and constants ===== */
+
+typedef int32_t q16_t; // Q16.16: range +-32768, resolution 1.5e-5
+typedef int64_t q32_t; // Q32.32: range +-2.1e9, resolution 2.3e-10
+
+const q16_t Q16_ONE = 0x00010000L;
+const q16_t Q16_MAX = INT32_MAX;
+const q16_t Q16_MIN = INT32_MIN;
+const q16_t Q16_PI = 205887L;      // pi
+const q16_t Q16_HALF_PI = 102944L; // pi / 2
+const q16_t Q16_TWO_PI = 411775L;  // 2 pi
+const q32_t Q32_ONE = 0x0000000100000000LL;
+const q32_t Q32_MAX = INT64_MAX;
+const q32_t Q32_MIN = INT64_MIN;
+
+/* ===== conversions ===== */
+
+inline q16_t q16_from_int(int32_t i)
+{
+  if (i > 32767)
+    return Q16_MAX;
+  if (i < -32768)
+    return Q16_MIN;
+  return i * Q16_ONE;
+}
+// NOTE: compile-time constants only; avoid on hot paths (soft-float)
+inline q16_t q16_from_double(double d)
+{
+  return (q16_t)(d * 65536.0 + (d >= 0 ? 0.5 : -0.5));
+}
+inline double q16_to_double(q16_t a)
+{
+  return a / 65536.0;
+}
+// integer part, rounded towards zero
+inline int32_t q16_to_int(q16_t a)
+{
+  return a >= 0 ? a >> 16 : -((-a) >> 16);
+}
+// a / b as Q16.16, e.g. q16_from_ratio(553, 10) for 55.3
+inline q16_t q16_from_ratio(int32_t a, int32_t b)
+{
+  if (b == 0)
+    return a >= 0 ? Q16_MAX : Q16_MIN;
+  int64_t r = ((int64_t)a << 16) / b;
+  return r > Q16_MAX ? Q16_MAX : (r < Q16_MIN ? Q16_MIN : (q16_t)r);
+}
+inline q32_t q32_from_q16(q16_t a)
+{
+  return (q32_t)a << 16;
+}
+inline q16_t q32_to_q16(q32_t a)
+{
+  q32_t r = a >> 16;
+  return r > Q16_MAX ? Q16_MAX : (r < Q16_MIN ? Q16_MIN : (q16_t)r);
+}
+inline q32_t q32_from_int(int32_t i)
+{
+  return (q32_t)i << 32;
+}
+inline int32_t q32_to_int(q32_t a)
+{
+  return a >= 0 ? (int32_t)(a >> 32) : -(int32_t)((-a) >> 32);
+}
+
+/* ===== saturating Q16.16 arithmetic ===== */
+
+inline q16_t q16_add(q16_t a, q16_t b)
+{
+  q16_t r = (q16_t)((uint32_t)a + (uint32_t)b);
+  if (((a ^ r) & (b ^ r)) < 0) // both operands differ in sign from result
+    return a < 0 ? Q16_MIN : Q16_MAX;
+  return r;
+}
+inline q16_t q16_sub(q16_t a, q16_t b)
+{
+  q16_t r = (q16_t)((uint32_t)a - (uint32_t)b);
+  if (((a ^ b) & (a ^ r)) < 0)
+    return a < 0 ? Q16_MIN : Q16_MAX;
+  return r;
+}
+inline q16_t q16_mul(q16_t a, q16_t b)
+{
+  int64_t r = (int64_t)a * b;
+  r += (r >= 0 ? 0x8000 : -0x8000); // round to nearest
+  r /= 65536;
+  return r > Q16_MAX ? Q16_MAX : (r < Q16_MIN ? Q16_MIN : (q16_t)r);
+}
+inline q16_t q16_div(q16_t a, q16_t b)
+{
+  if (b == 0)
+    return a >= 0 ? Q16_MAX : Q16_MIN;
+  int64_t r = ((int64_t)a << 16) / b;
+  return r > Q16_MAX ? Q16_MAX : (r < Q16_MIN ? Q16_MIN : (q16_t)r);
+}
+inline q16_t q16_abs(q16_t a)
+{
+  return a >= 0 ? a : (a == Q16_MIN ? Q16_MAX : -a);
+}
+
+/* ===== saturating Q32.32 arithmetic ===== */
+
+inline q32_t q32_add(q32_t a, q32_t b)
+{
+  q32_t r = (q32_t)((uint64_t)a + (uint64_t)b);
+  if (((a ^ r) & (b ^ r)) < 0)
+    return a < 0 ? Q32_MIN : Q32_MAX;
+  return r;
+}
+inline q32_t q32_sub(q32_t a, q32_t b)
+{
+  q32_t r = (q32_t)((uint64_t)a - (uint64_t)b);
+  if (((a ^ b) & (a ^ r)) < 0)
+    return a < 0 ? Q32_MIN : Q32_MAX;
+  return r;
+}
+// NOTE: 64x64 bit product assembled from 32-bit halves (no 128-bit ints)
+inline q32_t q32_mul(q32_t a, q32_t b)
+{
+  bool neg = (a < 0) != (b < 0);
+  uint64_t ua = a < 0 ? -(uint64_t)a : a;
+  uint64_t ub = b < 0 ? -(uint64_t)b : b;
+  uint64_t ah = ua >> 32, al = ua & 0xFFFFFFFFUL;
+  uint64_t bh = ub >> 32, bl = ub & 0xFFFFFFFFUL;
+  uint64_t hh = ah * bh, hl = ah * bl, lh = al * bh, ll = al * bl;
+  if (hh >> 31)
+    return neg ? Q32_MIN : Q32_MAX;
+  uint64_t r = (hh << 32);
+  uint64_t mid = hl + lh; // both < 2^64 / 2 since ah or bh < 2^31
+  if (mid < hl || r + mid < r)
+    return neg ? Q32_MIN : Q32_MAX;
+  r += mid;
+  uint64_t lo = (ll >> 32) + ((ll >> 31) & 1); // round to nearest
+  if (r + lo < r || r + lo > (uint64_t)Q32_MAX)
+    return neg ? Q32_MIN : Q32_MAX;
+  r += lo;
+  return neg ? -(q32_t)r : (q32_t)r;
+}
+// NOTE: restoring division, one quotient bit per iteration
+inline q32_t q32_div(q32_t a, q32_t b)
+{
+  if (b == 0)
+    return a >= 0 ? Q32_MAX : Q32_MIN;
+  bool neg = (a < 0) != (b < 0);
+  uint64_t ua = a < 0 ? -(uint64_t)a : a;
+  uint64_t ub = b < 0 ? -(uint64_t)b : b;
+  uint64_t q = ua / ub, rem = ua % ub;
+  if (q >> 31)
+    return neg ? Q32_MIN : Q32_MAX;
+  for (int i = 0; i < 32; i++)
+  {
+    bool carry = rem >> 63;
+    rem <<= 1;
+    q <<= 1;
+    if (carry || rem >= ub)
+    {
+      rem -= ub;
+      q |= 1;
+    }
+  }
+  return neg ? -(q32_t)q : (q32_t)q;
+}
+
+/* ===== functions ===== */
+
+// square root; negative input yields 0
+inline q16_t q16_sqrt(q16_t a)
+{
+  if (a <= 0)
+    return 0;
+  uint64_t n = (uint64_t)a << 16, r = 0, bit = (uint64_t)1 << 46;
+  while (bit > n)
+    bit >>= 2;
+  while (bit)
+  {
+    if (n >= r + bit)
+    {
+      n -= r + bit;
+      r = (r >> 1) + bit;
+    }
+    else
+      r >>= 1;
+    bit >>= 2;
+  }
+  return (q16_t)r;
+}
+
+// CORDIC angle table: atan(2^-i) in Q16.16 radians
+const int Q16_CORDIC_ITER = 16;
+const int32_t q16_cordic_atan[Q16_CORDIC_ITER] FIXED_PROGMEM = {
+    51472, 30386, 16055, 8150, 4091, 2047, 1024, 512,
+    256, 128, 64, 32, 16, 8, 4, 2};
+const q16_t Q16_CORDIC_K = 39797; // 1 / CORDIC gain
+
+// sine and cosine of an angle in Q16.16 radians (CORDIC rotation)
+inline void q16_sincos(q16_t angle, q16_t *s, q16_t *c)
+{
+  // reduce to [-pi, pi], then to [-pi/2, pi/2]
+  angle %= Q16_TWO_PI;
+  if (angle > Q16_PI)
+    angle -= Q16_TWO_PI;
+  else if (angle < -Q16_PI)
+    angle += Q16_TWO_PI;
+  bool flip = false;
+  if (angle > Q16_HALF_PI)
+  {
+    angle -= Q16_PI;
+    flip = true;
+  }
+  else if (angle < -Q16_HALF_PI)
+  {
+    angle += Q16_PI;
+    flip = true;
+  }
+  int32_t x = Q16_CORDIC_K, y = 0, z = angle;
+  for (int i = 0; i < Q16_CORDIC_ITER; i++)
+  {
+    int32_t dx = x >> i, dy = y >> i;
+    int32_t dz = FIXED_READ_TABLE(q16_cordic_atan + i);
+    if (z >= 0)
+    {
+      x -= dy;
+      y += dx;
+      z -= dz;
+    }
+    else
+    {
+      x += dy;
+      y -= dx;
+      z += dz;
+    }
+  }
+  *s = flip ? -y : y;
+  *c = flip ? -x : x;
+}
+inline q16_t q16_sin(q16_t angle)
+{
+  q16_t s, c;
+  q16_sincos(angle, &s, &c);
+  return s;
+}
+inline q16_t q16_cos(q16_t angle)
+{
+  q16_t s, c;
+  q16_sincos(angle, &s, &c);
+  return c;
+}
+
+// angle of (x, y) in Q16.16 radians, in [-pi, pi] (CORDIC vectoring)
+inline q16_t q16_atan2(q16_t y, q16_t x)
+{
+  if (x == 0 && y == 0)
+    return 0;
+  if (x == Q16_MIN || y == Q16_MIN) // -Q16_MIN overflows; halve both
+  {
+    x >>= 1;
+    y >>= 1;
+  }
+  int32_t z = 0;
+  if (x < 0) // rotate into the right half plane
+  {
+    z = y >= 0 ? Q16_PI : -Q16_PI;
+    x = -x;
+    y = -y;
+  }
+  // keep headroom for the CORDIC gain, and precision for small vectors
+  while (x >= (1L << 29) || y >= (1L << 29) || y <= -(1L << 29))
+  {
+    x >>= 1;
+    y >>= 1;
+  }
+  while (x < (1L << 20) && y < (1L << 20) && y > -(1L << 20))
+  {
+    x <<= 1;
+    y <<= 1;
+  }
+  for (int i = 0; i < Q16_CORDIC_ITER; i++)
+  {
+    int32_t dx = x >> i, dy = y >> i;
+    int32_t dz = FIXED_READ_TABLE(q16_cordic_atan + i);
+    if (y > 0)
+    {
+      x += dy;
+      y -= dx;
+      z += dz;
+    }
+    else
+    {
+      x -= dy;
+      y += dx;
+      z -= dz;
+    }
+  }
+  if (z > Q16_PI)
+    z -= Q16_TWO_PI;
+  else if (z < -Q16_PI)
+    z += Q16_TWO_PI;
+  return z;
+}
+
+/* ===== formatting ===== */
+
+// format a Q16.16 number for a display row of len digits
+// NOTE: same layout as LC_Display::setDouble(): buf[0] is the sign, the
+//       remaining digits carry as many decimals as fit; for |a| < 1 the
+//       leading '0' is omitted and the dot goes directly after the sign
+inline void q16_format(q16_t a, char *buf, bool *dots, int len)
+{
+  buf[0] = a >= 0 ? ' ' : '-';
+  uint64_t m = a >= 0 ? (uint64_t)a : (uint64_t)(-(int64_t)a);
+  uint32_t ip = m >> 16;
+  int n = 0; // integer digits
+  for (uint32_t t = ip; t; t /= 10)
+    n += 1;
+  int digits = len - 1, f = n ? digits - n : digits;
+  if (f < 0) // integer part too long; keep the lowest digits
+    f = 0;
+  uint64_t p, v;
+  while (true) // round, and redo with one decimal less if that carries over
+  {
+    p = 1;
+    for (int i = 0; i < f; i++)
+      p *= 10;
+    v = (m * p + 0x8000) >> 16; // rounded, scaled by 10^f
+    uint64_t lim = p;
+    for (int i = 0; i < n; i++)
+      lim *= 10;
+    if (v < lim || f == 0)
+      break;
+    n += 1;
+    f -= 1;
+  }
+  for (int i = 0; i < len; i++)
+    dots[i] = false;
+  for (int i = digits; i >= 1; i--)
+  {
+    buf[i] = '0' + v % 10;
+    v /= 10;
+  }
+  dots[n] = f > 0 || n == 0; // dot after the integer digits
+}
+
+} // namespace Fixed
+
+#endif // FIXED_H
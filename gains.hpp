@@ -0,0 +1,45 @@
+/*
+ * Control loop tuning
+ * Rate, gains and limits of the holds in control.hpp
+ * NOTE: constants and pid.hpp only, no Arduino headers, so
+ *       test/pid_test.cpp runs the plant model with these very values
+ */
+
+#ifndef GAINS_H
+#define GAINS_H
+
+#include "pid.hpp"
+
+#define CTL_RATE_HZ 10 // loop rate, in Hz
+
+namespace Control
+{
+
+struct Gains
+{
+  int16_t unit; // process value units per controller unit
+  q16_t kp, ki, kd, out_min, out_max, rate_max; // see Pid
+};
+
+// altitude: 1 m/s per 10 m off, at most 20 m/s, 5 m/s per second
+// NOTE: runs in 10 m units to stay within the Q16.16 range
+const Gains ALT_GAINS = {10, Fixed::Q16_ONE, 0, 0, -20 * Fixed::Q16_ONE,
+                         20 * Fixed::Q16_ONE, 5 * Fixed::Q16_ONE};
+// vertical speed: PI on the throttle, at most half throttle per second
+const Gains VSPD_GAINS = {1, Fixed::Q16_ONE / 20, Fixed::Q16_ONE / 20, 0, 0,
+                          Fixed::Q16_ONE, Fixed::Q16_ONE / 2};
+
+// set a controller's gains and limits; call pid_reset() next
+inline void pid_init(Pid *p, const Gains &g)
+{
+  p->kp = g.kp;
+  p->ki = g.ki;
+  p->kd = g.kd;
+  p->out_min = g.out_min;
+  p->out_max = g.out_max;
+  p->rate_max = g.rate_max;
+}
+
+} // namespace Control
+
+#endif // GAINS_H
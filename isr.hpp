@@ -1,21 +1,32 @@
 /*
  * ISR definitions
- * defines interrupts for handling keypad and screen updates
+ * defines interrupts for the timer wheel tick (keypad and screen
+ * updates), the kRPC serial link and the supervisor
  */
 
 #ifndef ISR_H
 #define ISR_H
 
 #include "devices.hpp"
+#include "comm.hpp"
+#include "control.hpp"
 
 /* ===== scheduled system interrupt handling ===== */
 
-ISR(TIMER4_COMPA_vect) // keypad update
+ISR(TIMER3_COMPA_vect) // 1 kHz timer wheel tick
+{
+  Wheel::tick_isr();
+}
+
+void keypad_update() // W_ISR, at INT_FREQ_2
 {
   Devices::keypad->ISRUpdate();
 }
 
-ISR(TIMER5_COMPA_vect) // screen and LED update (from screen buffer)
+// NOTE: W_NOBLOCK, so the kRPC USART and millis() keep running through
+//       the SPI transfers; an update that comes due while the last one
+//       is still busy is skipped
+void screen_update() // screen and LED update, at System::disp_freq
 {
   // Devices::status_led->setActivityLED(true); // turn on activity LED
 
@@ -25,4 +36,45 @@ ISR(TIMER5_COMPA_vect) // screen and LED update (from screen buffer)
   // Devices::status_led->setActivityLED(false); // turn off activity LED
 }
 
+// register the periodic system work on the timer wheel and start it
+void timers_init()
+{
+  static_assert(1000 % INT_FREQ_2 == 0, "INT_FREQ_2 must divide 1000");
+  int t = Wheel::add(&keypad_update, Wheel::W_ISR);
+  Wheel::start(t, 1, 1000 / INT_FREQ_2);
+  System::disp_timer = Wheel::add(&screen_update, Wheel::W_NOBLOCK);
+  Wheel::start(System::disp_timer, 1, 1000 / System::disp_freq);
+  Control::init();
+  System::timer_init();
+}
+
+// a verb or program ran past its time budget
+// NOTE: never unwinds out of an interruptible (W_NOBLOCK) timer callback
+ISR(WDT_vect)
+{
+  if (Wheel::nb_busy)
+    System::sup_defer();
+  else
+  {
+    if (System::sup_armed)
+      Comm::xact_abort(); // a kRPC call left half done, if any
+    System::sup_unwind();
+  }
+}
+
+ISR(USART_RX_VECT(KRPC_USART)) // kRPC link
+{
+  Comm::link.rx_isr();
+}
+
+ISR(USART_UDRE_VECT(KRPC_USART))
+{
+  Comm::link.udre_isr();
+}
+
+ISR(EE_READY_vect) // asynchronous EEPROM writes
+{
+  Storage::ee_isr();
+}
+
 #endif // ISR_H
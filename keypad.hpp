@@ -0,0 +1,129 @@
+/*
+ * Key debouncer and event queue
+ * Debounces a word of raw key bits and queues press, release, hold and
+ * repeat events for the UI
+ * NOTE: integer arithmetic only, no Arduino headers, so it builds on the
+ *       host for runs against scripted scans, see test/keypad_test.cpp;
+ *       the matrix scan itself is Devices::Keypad_I
+ */
+
+#ifndef KEYPAD_H
+#define KEYPAD_H
+
+#include <stdint.h>
+
+namespace Devices
+{
+
+enum key_event_t // event type, in the high nibble of an event
+{
+  KEY_PRESS = 0x10,
+  KEY_RELEASE = 0x20,
+  KEY_HOLD = 0x30,  // down for HOLD ticks
+  KEY_REPEAT = 0x40 // every REPEAT ticks after a hold (repeat_mask_ keys)
+};
+
+// per-key debouncing, hold/repeat and an event queue for KEYS keys
+// NOTE: one bit per key in 16-bit words; a key changes state after
+//       4 consistent updates
+// NOTE: events are key_event_t | key index
+template <uint8_t KEYS, uint16_t HOLD, uint16_t REPEAT, uint8_t QUEUE_LEN>
+class KeyEvents
+{
+public:
+  unsigned int overflows = 0; // events dropped with the queue full
+
+protected:
+  uint16_t repeat_mask_; // keys that auto-repeat
+  // debouncer: debounced state and 2-bit vertical counters
+  uint16_t state_ = 0;
+  uint16_t ct0_ = 0xFFFF, ct1_ = 0xFFFF;
+  // hold/repeat tracking for the last key pressed
+  int8_t held_ = -1;
+  uint16_t held_ticks_ = 0;
+  // event queue; the ISR writes head_, the UI writes tail_
+  uint8_t queue_[QUEUE_LEN];
+  volatile uint8_t head_ = 0, tail_ = 0;
+
+  void push(uint8_t ev)
+  {
+    uint8_t next = (head_ + 1) & (QUEUE_LEN - 1);
+    if (next == tail_)
+    {
+      overflows += 1;
+      return;
+    }
+    queue_[head_] = ev;
+    head_ = next;
+  }
+
+public:
+  explicit KeyEvents(uint16_t repeat_mask = 0) : repeat_mask_(repeat_mask)
+  {
+    static_assert(KEYS <= 16, "keys are 16 bits");
+    static_assert(HOLD > 0 && REPEAT > 0, "hold and repeat take a tick");
+    static_assert(QUEUE_LEN && !(QUEUE_LEN & (QUEUE_LEN - 1)),
+                  "queue length must be a power of 2");
+  }
+  // debounced keys; bit set if the key is down
+  uint16_t keys() const
+  {
+    return state_;
+  }
+  // pop the next event; 0 if none
+  uint8_t getEvent()
+  {
+    if (tail_ == head_)
+      return 0;
+    uint8_t ev = queue_[tail_];
+    tail_ = (tail_ + 1) & (QUEUE_LEN - 1);
+    return ev;
+  }
+  // whether an event is waiting to be read
+  bool hasKeyEvent() const
+  {
+    return tail_ != head_;
+  }
+  // debounce one raw scan (bit set if the key is down) and queue events
+  // NOTE: called from the ISR, once per tick
+  void update(uint16_t raw)
+  {
+    uint16_t i = state_ ^ raw; // keys that differ from their state
+    ct0_ = ~(ct0_ & i);        // count down, or reset where equal
+    ct1_ = ct0_ ^ (ct1_ & i);
+    i &= ct0_ & ct1_; // counter wrapped around: state changes
+    state_ ^= i;
+    held_ticks_ += 1; // NOTE: a press below restarts it at 0
+    for (int k = 0; i; k++, i >>= 1)
+    {
+      if (!(i & 1))
+        continue;
+      if (state_ & (1 << k))
+      {
+        push(KEY_PRESS | k);
+        held_ = k;
+        held_ticks_ = 0;
+      }
+      else
+      {
+        push(KEY_RELEASE | k);
+        if (held_ == k)
+          held_ = -1;
+      }
+    }
+    if (held_ < 0)
+      return;
+    if (held_ticks_ == HOLD)
+      push(KEY_HOLD | held_);
+    else if (held_ticks_ == HOLD + REPEAT)
+    {
+      held_ticks_ = HOLD; // NOTE: no division in the ISR
+      if (repeat_mask_ & (1 << held_))
+        push(KEY_REPEAT | held_);
+    }
+  }
+};
+
+} // namespace Devices
+
+#endif // KEYPAD_H
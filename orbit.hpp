@@ -0,0 +1,253 @@
+/*
+ * Orbital mechanics
+ * Two-body (Keplerian) orbit from a state vector sample, propagated locally
+ * NOTE: double is 32-bit on AVR; elements are computed once per sample and
+ *       propagation only solves Kepler's equation, which keeps errors well
+ *       below display resolution for the orbits KSP deals with
+ * NOTE: doesn't depend on Arduino headers, so it also builds on a host;
+ *       see test/orbit_test.cpp for the reference orbits
+ * NOTE: templates on the scalar type T s.t. the host tests can run the
+ *       math in float, as the Mega does; the firmware uses the double
+ *       typedefs
+ */
+
+#ifndef ORBIT_H
+#define ORBIT_H
+
+#include <math.h>
+
+namespace Orbit
+{
+
+/* ===== data structures ===== */
+
+// state vector in a non-rotating, body-centered frame (m, m/s)
+// NOTE: the handedness of the frame doesn't matter for the values below
+template <typename T>
+struct StateT
+{
+  T r[3];   // position
+  T v[3];   // velocity
+  T mu;     // gravitational parameter of the body (m^3/s^2)
+  T radius; // equatorial radius of the body (m)
+};
+typedef StateT<double> State;
+
+// orbital elements at the sample epoch
+template <typename T>
+struct ElementsT
+{
+  bool valid = false;
+  T mu;             // gravitational parameter (m^3/s^2)
+  T radius;         // body radius, for altitudes (m)
+  T a;              // semi-major axis (m); negative if hyperbolic
+  T e;              // eccentricity
+  T p;              // semi-latus rectum (m)
+  T n;              // mean motion (rad/s)
+  T m0;             // mean anomaly at the epoch (rad)
+  unsigned long t0; // epoch, in local milliseconds
+};
+typedef ElementsT<double> Elements;
+
+// values derived at a given time
+template <typename T>
+struct DerivedT
+{
+  T ap_alt; // apoapsis altitude (m); NAN if not bound
+  T pe_alt; // periapsis altitude (m)
+  T alt;    // current altitude (m)
+  T period; // orbital period (s); NAN if not bound
+  T t_ap;   // time to apoapsis (s); NAN if not bound
+  T t_pe;   // time to periapsis (s); NAN if past periapsis on escape
+  T nu;     // true anomaly (rad)
+};
+typedef DerivedT<double> Derived;
+
+const double TWO_PI_D = 2 * M_PI;
+const int KEPLER_ITER = 8; // Newton iterations for Kepler's equation
+
+/* ===== helpers ===== */
+
+template <typename T>
+inline T dot(const T *a, const T *b)
+{
+  return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+template <typename T>
+inline void cross(const T *a, const T *b, T *c)
+{
+  c[0] = a[1] * b[2] - a[2] * b[1];
+  c[1] = a[2] * b[0] - a[0] * b[2];
+  c[2] = a[0] * b[1] - a[1] * b[0];
+}
+// wrap an angle to [0, 2pi)
+template <typename T>
+inline T wrap(T x)
+{
+  const T two_pi = TWO_PI_D;
+  x = fmod(x, two_pi);
+  return x < 0 ? x + two_pi : x;
+}
+
+// x - sin(x) and sinh(x) - x, without the cancellation for small x
+// NOTE: near e = 1 both sides of Kepler's equation are small differences
+//       of large terms; float loses them entirely near periapsis
+template <typename T>
+inline T cubic_series(T x, int sign) // x^3 / 3! + sign x^5 / 5! + ...
+{
+  T x2 = sign * x * x, t = 1;
+  for (int k = 12; k >= 4; k -= 2) // to x^13 / 13!, past float at |x| < 1
+    t = 1 + x2 / (k * (k + 1)) * t;
+  return x * x * x / 6 * t;
+}
+template <typename T>
+inline T x_sin(T x)
+{
+  return fabs(x) < 1 ? cubic_series(x, -1) : x - sin(x);
+}
+template <typename T>
+inline T sinh_x(T x)
+{
+  return fabs(x) < 1 ? cubic_series(x, 1) : sinh(x) - x;
+}
+
+// solve Kepler's equation for the eccentric (e < 1) or hyperbolic (e > 1)
+// anomaly, given the mean anomaly
+template <typename T>
+inline T solve_kepler(T m, T e)
+{
+  const T pi = M_PI, two_pi = TWO_PI_D;
+  if (e < 1)
+  {
+    // solve on [0, pi] and mirror; near e = 1 and m = 0, E^3 / 6 ~ m
+    // is a starting point that converges within KEPLER_ITER
+    m = wrap(m);
+    bool mirror = m > pi;
+    if (mirror)
+      m = two_pi - m;
+    T x = m;
+    if (e >= T(0.8))
+    {
+      x = cbrt(6 * m);
+      x = x < pi ? x : pi;
+    }
+    for (int i = 0; i < KEPLER_ITER; i++)
+    {
+      // x - e sin(x) - m over 1 - e cos(x), as differences from e = 1
+      T sh = sin(x / 2);
+      T dx = ((1 - e) * x + e * x_sin(x) - m) / ((1 - e) + 2 * e * sh * sh);
+      x -= dx;
+      if (fabs(dx) < T(1e-7))
+        break;
+    }
+    return mirror ? two_pi - x : x;
+  }
+  // solve for |m| (the equation is odd), starting from the lower of two
+  // upper bounds, H^3 / 6 <= m and (e - 1) sinh(H) <= m, so Newton
+  // converges from above
+  T am = fabs(m), y = am / (e - 1);
+  T x = log(y + sqrt(y * y + 1)); // asinh(), which avr-libc lacks
+  T c = cbrt(6 * am);
+  x = c < x ? c : x;
+  for (int i = 0; i < KEPLER_ITER * 2; i++)
+  {
+    T sh = sinh(x / 2);
+    T dx = ((e - 1) * x + e * sinh_x(x) - am) / ((e - 1) + 2 * e * sh * sh);
+    x -= dx;
+    if (fabs(dx) < T(1e-7))
+      break;
+  }
+  return m < 0 ? -x : x;
+}
+
+/* ===== elements and propagation ===== */
+
+// compute the elements from a state vector sampled at local time t
+// returns 0 on success, -1 if the state is degenerate
+template <typename T>
+inline int from_state(const StateT<T> &s, unsigned long t, ElementsT<T> *el)
+{
+  el->valid = false;
+  T r = sqrt(dot(s.r, s.r));
+  T v2 = dot(s.v, s.v);
+  T h[3];
+  cross(s.r, s.v, h);
+  T h2 = dot(h, h);
+  if (r <= 0 || s.mu <= 0 || h2 <= 0) // radial trajectory, no orbit to show
+    return -1;
+  T rv = dot(s.r, s.v);
+  // eccentricity vector, e = ((v^2 - mu/r) r - (r.v) v) / mu
+  T ev[3];
+  for (int i = 0; i < 3; i++)
+    ev[i] = ((v2 - s.mu / r) * s.r[i] - rv * s.v[i]) / s.mu;
+  T e = sqrt(dot(ev, ev));
+  el->mu = s.mu;
+  el->radius = s.radius;
+  el->e = e;
+  el->p = h2 / s.mu;
+  el->t0 = t;
+  if (fabs(1 - e) < T(1e-6)) // parabolic; nudge to a barely bound orbit
+    e = el->e = 1 - T(1e-6);
+  // NOTE: better conditioned than the energy, and 1 - e^2 as a product
+  el->a = el->p / ((1 - e) * (1 + e)); // negative if hyperbolic
+  el->n = sqrt(s.mu / fabs(el->a * el->a * el->a));
+  // true anomaly from e cos(nu) = p / r - 1 and e sin(nu) = h (r.v) /
+  // (mu r), then the mean anomaly at the epoch
+  // NOTE: not acos(), which loses half the digits near periapsis
+  T nu = 0;
+  if (e > T(1e-9))
+    nu = atan2(sqrt(h2) * rv / (s.mu * r), el->p / r - 1);
+  if (e < 1)
+  {
+    T ea = 2 * atan(sqrt((1 - e) / (1 + e)) * tan(nu / 2));
+    el->m0 = wrap((1 - e) * ea + e * x_sin(ea));
+  }
+  else
+  {
+    T x = sqrt((e - 1) / (e + 1)) * tan(nu / 2);
+    T ha = log((1 + x) / (1 - x)); // 2 atanh(x)
+    el->m0 = (e - 1) * ha + e * sinh_x(ha);
+  }
+  el->valid = true;
+  return 0;
+}
+
+// derive the display values at local time t
+template <typename T>
+inline void propagate(const ElementsT<T> &el, unsigned long t, DerivedT<T> *d)
+{
+  const T pi = M_PI, two_pi = TWO_PI_D;
+  T dt = (long)(t - el.t0) / T(1000);
+  T m = el.m0 + el.n * dt;
+  T e = el.e, r;
+  d->pe_alt = el.p / (1 + e) - el.radius;
+  if (e < 1)
+  {
+    m = wrap(m);
+    T ea = solve_kepler(m, e);
+    T sh = sin(ea / 2);
+    r = el.a * ((1 - e) + 2 * e * sh * sh); // a (1 - e cos(E))
+    d->nu = wrap(2 * atan2(sqrt(1 + e) * sin(ea / 2),
+                           sqrt(1 - e) * cos(ea / 2)));
+    d->period = two_pi / el.n;
+    d->ap_alt = el.a * (1 + e) - el.radius;
+    d->t_ap = wrap(pi - m) / el.n;
+    d->t_pe = wrap(-m) / el.n;
+  }
+  else
+  {
+    T ha = solve_kepler(m, e);
+    T sh = sinh(ha / 2);
+    r = -el.a * ((e - 1) + 2 * e * sh * sh); // a (1 - e cosh(H))
+    d->nu = 2 * atan(sqrt((e + 1) / (e - 1)) * tanh(ha / 2));
+    d->period = NAN;
+    d->ap_alt = NAN;
+    d->t_ap = NAN;
+    d->t_pe = m < 0 ? -m / el.n : NAN;
+  }
+  d->alt = r - el.radius;
+}
+
+} // namespace Orbit
+
+#endif // ORBIT_H
@@ -0,0 +1,83 @@
+/*
+ * PID controller
+ * Q16.16 PID/PI step with anti-windup and an output slew limit
+ * NOTE: integer arithmetic and fixed.hpp only, no Arduino headers, so
+ *       it builds on the host for runs against a plant model, see
+ *       test/pid_test.cpp
+ */
+
+#ifndef PID_H
+#define PID_H
+
+#include "fixed.hpp"
+
+namespace Control
+{
+
+using Fixed::q16_t;
+
+struct Pid
+{
+  // gains, per unit of error: kp, ki (per second), kd (seconds)
+  q16_t kp, ki, kd;
+  q16_t out_min, out_max; // output limits
+  q16_t rate_max;         // output slew limit, per second (0: none)
+  // state
+  q16_t integ;   // integral term, in output units
+  q16_t last_pv; // process value of the last step
+  q16_t out;     // output of the last step
+  bool primed;   // last_pv is valid
+};
+
+inline q16_t q16_clamp(q16_t a, q16_t lo, q16_t hi)
+{
+  return a < lo ? lo : (a > hi ? hi : a);
+}
+
+// restart the controller from output out, e.g. the current throttle
+// NOTE: bumpless takeover: the first step seeds the integral term s.t.
+//       its output is out; a P-only controller (ki = 0) keeps a zero
+//       integral, as a seed would never decay and offset the setpoint,
+//       and slews from out instead (rate_max)
+inline void pid_reset(Pid *p, q16_t out)
+{
+  p->out = q16_clamp(out, p->out_min, p->out_max);
+  p->integ = 0;
+  p->primed = false;
+}
+
+// one controller step of dt seconds; returns the new output
+// NOTE: the derivative acts on the process value, so setpoint steps
+//       don't kick the output
+// NOTE: anti-windup: the integral stops growing while the output is
+//       saturated in the direction of the error, and stays within the
+//       output limits
+inline q16_t pid_step(Pid *p, q16_t sp, q16_t pv, q16_t dt)
+{
+  using namespace Fixed;
+  q16_t err = q16_sub(sp, pv);
+  q16_t u = q16_mul(p->kp, err);
+  if (!p->primed && p->ki)
+    p->integ = q16_clamp(q16_sub(p->out, u), p->out_min, p->out_max);
+  if (p->primed && p->kd)
+    u = q16_sub(u, q16_mul(p->kd, q16_div(q16_sub(pv, p->last_pv), dt)));
+  q16_t integ = q16_add(p->integ, q16_mul(q16_mul(p->ki, err), dt));
+  integ = q16_clamp(integ, p->out_min, p->out_max);
+  q16_t v = q16_add(u, integ);
+  if (!((v > p->out_max && err > 0) || (v < p->out_min && err < 0)))
+    p->integ = integ;
+  u = q16_clamp(q16_add(u, p->integ), p->out_min, p->out_max);
+  if (p->rate_max) // from the last output, or the pid_reset() one
+  {
+    q16_t step = q16_mul(p->rate_max, dt);
+    u = q16_clamp(u, q16_sub(p->out, step), q16_add(p->out, step));
+  }
+  p->last_pv = pv;
+  p->out = u;
+  p->primed = true;
+  return u;
+}
+
+} // namespace Control
+
+#endif // PID_H
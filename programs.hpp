@@ -25,54 +25,63 @@ namespace Programs
 //
 
 // playground program
+// NOTE: waits on the event bus; see SysUtils::SysManager::wait_events()
 int program_01(int *p_stage, void **data_ptr)
 {
+  using SysUtils::SysManager;
   if (*p_stage == 0)
   {
     *p_stage = 1;
     *data_ptr = calloc(1, sizeof(int));
-    return SysUtils::SysManager::P_RUN;
+    return SysManager::P_RUN;
   }
   if (*p_stage == 1)
   {
-    // request verb/noun switch
+    // request verb/noun switch, then sleep until the operator answers
     SysUtils::sys->request_vn(0, 0);
+    SysUtils::sys->wait_events(SysManager::EV_KYRL_ACC |
+                               SysManager::EV_KYRL_REJ);
     *p_stage = 2;
+    return SysManager::P_RUN;
   }
   if (*p_stage == 2)
   {
     // if request accepted, proceed to next stage
-    if (SysUtils::sys->keyrel_req == SysUtils::SysManager::KYRL_ACC)
+    if (SysUtils::sys->keyrel_req == SysManager::KYRL_ACC)
     {
       *p_stage = 3;
-      return SysUtils::SysManager::P_RUN;
+      return SysManager::P_RUN;
     }
     // if rejected throw program error
-    else if (SysUtils::sys->keyrel_req == SysUtils::SysManager::KYRL_REJ)
-      return SysUtils::SysManager::P_PGM_ERR;
-    else // wait
-      return SysUtils::SysManager::P_RUN;
+    else if (SysUtils::sys->keyrel_req == SysManager::KYRL_REJ)
+      return SysManager::P_PGM_ERR;
+    else // woken by something else, keep waiting
+      SysUtils::sys->wait_events(SysManager::EV_KYRL_ACC |
+                                 SysManager::EV_KYRL_REJ);
+    return SysManager::P_RUN;
   }
   if (*p_stage == 3)
   {
+    // hand over to program 02
+    // NOTE: the switch kills this program and frees its data right away,
+    //       so don't touch data_ptr after this
     SysUtils::sys->request_pgm(2, true);
-    *((int *)*data_ptr) += 1;
-    if (0 == SysUtils::sys->get_verb()) // avoid conflict with verbs
-      Devices::lcd->setInt(1, *((int *)*data_ptr));
-    if (0 != SysUtils::sys->get_verb())
-      SysUtils::sys->request_vn(0, 0);
-    return SysUtils::SysManager::P_RUN;
+    return SysManager::P_RUN;
   }
-  return SysUtils::SysManager::P_COMPLETE; // ???
+  return SysManager::P_COMPLETE; // ???
 }
 
+// counts up while the null verb is displayed
+// NOTE: ticks every 100 ms instead of every cycle, and takes the display
+//       back as soon as the operator's verb completes
 int program_02(int *p_stage, void **data_ptr)
 {
+  using SysUtils::SysManager;
   if (*p_stage == 0)
   {
     *p_stage = 1;
     *data_ptr = calloc(1, sizeof(int));
-    return SysUtils::SysManager::P_RUN;
+    return SysManager::P_RUN;
   }
   if (*p_stage == 1)
   {
@@ -83,34 +92,43 @@ int program_02(int *p_stage, void **data_ptr)
   if (*p_stage == 2)
   {
     // if request accepted, proceed to next stage
-    if (SysUtils::sys->keyrel_req == SysUtils::SysManager::KYRL_ACC)
+    if (SysUtils::sys->keyrel_req == SysManager::KYRL_ACC)
     {
       *p_stage = 3;
-      return SysUtils::SysManager::P_RUN;
+      return SysManager::P_RUN;
     }
     // if rejected throw program error
-    else if (SysUtils::sys->keyrel_req == SysUtils::SysManager::KYRL_REJ)
-      return SysUtils::SysManager::P_PGM_ERR;
-    else // wait
-      return SysUtils::SysManager::P_RUN;
+    else if (SysUtils::sys->keyrel_req == SysManager::KYRL_REJ)
+      return SysManager::P_PGM_ERR;
+    SysUtils::sys->wait_events(SysManager::EV_KYRL_ACC |
+                               SysManager::EV_KYRL_REJ);
+    return SysManager::P_RUN;
   }
   if (*p_stage == 3)
   {
     *((int *)*data_ptr) += 1;
-    if (0 == SysUtils::sys->get_verb()) // avoid conflict with verbs
-      Devices::lcd->setInt(1, *((int *)*data_ptr));
+    Devices::lcd->setInt(1, *((int *)*data_ptr)); // shows under verbs
     if (0 != SysUtils::sys->get_verb())
       SysUtils::sys->request_vn(0, 0);
-    return SysUtils::SysManager::P_RUN;
+    SysUtils::sys->sleep_program(100);
+    SysUtils::sys->wait_events(SysManager::EV_VERB_DONE |
+                               SysManager::EV_KYRL_ACC);
+    return SysManager::P_RUN;
   }
-  return SysUtils::SysManager::P_COMPLETE; // ???
+  return SysManager::P_COMPLETE; // ???
 }
 
 void init_programs()
 {
   SysUtils::sys->register_program(0, NULL);
-  SysUtils::sys->register_program(1, &program_01);
-  SysUtils::sys->register_program(2, &program_02);
+  SysUtils::sys->register_program(1, &program_01, sizeof(int));
+  SysUtils::sys->register_program(2, &program_02, sizeof(int));
+  // script VM: EEPROM slots, then the built-in script
+  for (int i = 0; i < VM_SCRIPT_SLOTS; i++)
+    SysUtils::sys->register_program(VM_PGM_EE + i, &VM::run,
+                                    sizeof(VM::VM_State));
+  SysUtils::sys->register_program(VM_PGM_ROM, &VM::run,
+                                  sizeof(VM::VM_State));
 }
 
 } // namespace Programs
@@ -0,0 +1,290 @@
+/*
+ * Flight data recorder
+ * Telemetry samples and system events in an SRAM ring; the oldest
+ * records give way to new ones. Verb 74 dumps the ring over Serial,
+ * tools/fdr_decode.py turns the dump into CSV
+ * NOTE: record layout, all numbers LEB128 varints (signed: zigzag):
+ *       R_KEY    tag, time (ms), channel mask, every channel's value
+ *       R_SAMPLE tag, dt (ms), channel mask, masked channels' deltas
+ *       R_EVENT  tag, dt (ms), event_t, value (signed)
+ *       dt is the time since the previous record; deltas are against
+ *       the channel's previous value; a keyframe every FDR_KEY_EVERY
+ *       samples gives the decoder a starting point once the ring wraps
+ * NOTE: the ring lives in .noinit SRAM and survives resets, e.g. the one
+ *       a Mega takes when a host opens its USB serial port; each boot
+ *       starts with a keyframe, s.t. times restart from the new boot
+ */
+
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include "base.h"
+
+namespace Recorder
+{
+
+enum rec_t // record tags
+{
+  R_KEY = 1,
+  R_SAMPLE,
+  R_EVENT
+};
+
+enum event_t // R_EVENT kinds; value in parentheses
+{
+  E_KEY,          // key pressed (key char)
+  E_VN,           // verb/noun set (verb * 100 + noun)
+  E_PGM,          // program started (id), or killed (0)
+  E_VERB_PGM_ERR, // verb returned V_PGM_ERR (verb)
+  E_VERB_OPR_ERR, // verb returned V_OPR_ERR (verb)
+  E_PGM_PGM_ERR,  // program returned P_PGM_ERR (program)
+  E_PGM_OPR_ERR,  // program returned P_OPR_ERR (program)
+  E_OVERRUN,      // supervisor unwound a call (verb, or 100 + program)
+  E_BOOT          // system booted (MCUSR reset cause)
+};
+
+const uint8_t MAX_CH = 8; // channels in a channel mask
+const uint8_t REC_MAX = 2 + 5 + 1 + MAX_CH * 5; // longest record
+
+// the ring and its indices
+// NOTE: only trusted if the magic and CRC check out and the records walk
+//       from tail to head, as in WarmState
+struct Ring
+{
+  uint16_t magic;
+  uint16_t head, tail; // next write, oldest record
+  uint16_t crc;        // of magic, head and tail
+  uint8_t buf[FDR_LEN];
+};
+Ring store __attribute__((section(".noinit")));
+uint8_t *const ring = store.buf;
+uint16_t &head = store.head, &tail = store.tail;
+bool frozen = false;         // being dumped; records are dropped
+unsigned long dump_seen = 0; // time of the last dump step
+unsigned long last_t = 0;    // time of the last record
+int32_t last_x[MAX_CH];      // channel values of the last sample
+uint8_t since_key = FDR_KEY_EVERY; // samples since the last keyframe
+unsigned long dropped = 0;         // records dropped while frozen
+
+/* ===== encoding ===== */
+
+uint8_t put_varint(uint8_t *p, uint32_t v)
+{
+  uint8_t n = 0;
+  while (v >= 0x80)
+  {
+    p[n++] = v | 0x80;
+    v >>= 7;
+  }
+  p[n++] = v;
+  return n;
+}
+uint8_t put_signed(uint8_t *p, int32_t v)
+{
+  return put_varint(p, (uint32_t)v << 1 ^ (uint32_t)(v >> 31));
+}
+
+uint16_t used()
+{
+  return (head - tail) & (FDR_LEN - 1);
+}
+
+// ring position past the varint at pos
+uint16_t skip_varint(uint16_t pos)
+{
+  while (ring[pos] & 0x80)
+    pos = (pos + 1) & (FDR_LEN - 1);
+  return (pos + 1) & (FDR_LEN - 1);
+}
+// ring position past the record at pos
+uint16_t skip(uint16_t pos)
+{
+  uint8_t tag = ring[pos];
+  pos = skip_varint((pos + 1) & (FDR_LEN - 1)); // time or dt
+  uint8_t mask = ring[pos]; // channel mask, or event kind
+  pos = (pos + 1) & (FDR_LEN - 1);
+  uint8_t n = 1; // R_EVENT: the value
+  if (tag == R_KEY)
+    n = MAX_CH;
+  else if (tag == R_SAMPLE)
+    for (n = 0; mask; mask &= mask - 1)
+      n += 1;
+  while (n--)
+    pos = skip_varint(pos);
+  return pos;
+}
+
+uint16_t ring_crc()
+{
+  uint16_t crc = 0xFFFF;
+  const uint8_t *p = (const uint8_t *)&store;
+  for (uint8_t i = 0; i < offsetof(Ring, crc); i++)
+    crc = _crc16_update(crc, p[i]);
+  return crc;
+}
+
+// append a record, dropping the oldest ones to make room
+// NOTE: the bytes go in before head moves, s.t. a reset in between
+//       loses the record, not the ring
+void append(const uint8_t *r, uint8_t len)
+{
+  if (FDR_LEN - 1 - used() < len)
+  {
+    while (FDR_LEN - 1 - used() < len)
+      tail = skip(tail);
+    store.crc = ring_crc();
+  }
+  for (uint8_t i = 0; i < len; i++)
+    ring[(head + i) & (FDR_LEN - 1)] = r[i];
+  head = (head + len) & (FDR_LEN - 1);
+  store.crc = ring_crc();
+}
+
+// whether the ring kept over a reset checks out
+bool ring_valid()
+{
+  if (store.magic != FDR_MAGIC || store.crc != ring_crc() ||
+      head >= FDR_LEN || tail >= FDR_LEN)
+    return false;
+  uint16_t left = used();
+  for (uint16_t pos = tail; pos != head;)
+  {
+    if (ring[pos] < R_KEY || ring[pos] > R_EVENT)
+      return false;
+    uint16_t next = skip(pos);
+    uint16_t len = (next - pos) & (FDR_LEN - 1);
+    if (len > REC_MAX || len > left)
+      return false;
+    left -= len;
+    pos = next;
+  }
+  return true;
+}
+
+/* ===== recording ===== */
+
+// whether records are dropped
+// NOTE: a dump nobody steps any more (its verb was switched away) thaws
+//       after FDR_DUMP_TIMEOUT
+bool is_frozen()
+{
+  if (frozen && millis() - dump_seen > FDR_DUMP_TIMEOUT)
+    frozen = false;
+  return frozen;
+}
+
+// record a sample of n channels; mask marks the fresh ones
+// NOTE: stale channels keep their last value in keyframes
+void sample(uint8_t mask, const int32_t *x, uint8_t n)
+{
+  if (is_frozen())
+  {
+    dropped += 1;
+    return;
+  }
+  uint8_t rec[REC_MAX], len = 0;
+  unsigned long t = millis();
+  if (since_key >= FDR_KEY_EVERY)
+  {
+    rec[len++] = R_KEY;
+    len += put_varint(rec + len, t);
+    rec[len++] = mask;
+    for (uint8_t c = 0; c < MAX_CH; c++)
+    {
+      if (c < n && mask & 1 << c)
+        last_x[c] = x[c];
+      len += put_signed(rec + len, last_x[c]);
+    }
+    since_key = 0;
+  }
+  else
+  {
+    rec[len++] = R_SAMPLE;
+    len += put_varint(rec + len, t - last_t);
+    rec[len++] = mask;
+    for (uint8_t c = 0; c < n; c++)
+      if (mask & 1 << c)
+      {
+        len += put_signed(rec + len, x[c] - last_x[c]);
+        last_x[c] = x[c];
+      }
+    since_key += 1;
+  }
+  last_t = t;
+  append(rec, len);
+}
+
+// record a system event
+void event(uint8_t kind, int32_t value)
+{
+  if (is_frozen())
+  {
+    dropped += 1;
+    return;
+  }
+  uint8_t rec[REC_MAX], len = 0;
+  unsigned long t = millis();
+  rec[len++] = R_EVENT;
+  len += put_varint(rec + len, t - last_t);
+  rec[len++] = kind;
+  len += put_signed(rec + len, value);
+  last_t = t;
+  append(rec, len);
+}
+
+// keep the recording of the last run if it checks out, or start over;
+// then mark the boot; call once at boot with the reset cause
+void init(uint8_t cause)
+{
+  if (!ring_valid())
+  {
+    store.magic = FDR_MAGIC;
+    head = tail = 0;
+    store.crc = ring_crc();
+  }
+  since_key = FDR_KEY_EVERY;
+  sample(0, last_x, 0); // keyframe: the new boot's time base
+  event(E_BOOT, cause);
+}
+
+/* ===== dump ===== */
+// NOTE: over Serial: "FD", u16 length, u16 CRC16 of the records, then
+//       the records, oldest first (see tools/fdr_decode.py)
+
+uint16_t dump_pos, dump_left; // next byte to send, bytes left
+
+// freeze the ring and send the dump header
+void dump_begin()
+{
+  frozen = true;
+  dump_seen = millis();
+  dump_pos = tail;
+  dump_left = used();
+  uint16_t crc = 0xFFFF;
+  for (uint16_t i = tail; i != head; i = (i + 1) & (FDR_LEN - 1))
+    crc = _crc16_update(crc, ring[i]);
+  uint8_t hdr[6] = {'F', 'D', (uint8_t)dump_left,
+                    (uint8_t)(dump_left >> 8), (uint8_t)crc,
+                    (uint8_t)(crc >> 8)};
+  Serial.write(hdr, sizeof(hdr));
+}
+// send what fits in the TX buffer; returns the bytes still to send
+// NOTE: thaws the ring once done
+uint16_t dump_step()
+{
+  int room = Serial.availableForWrite();
+  dump_seen = millis();
+  while (dump_left && room-- > 0)
+  {
+    Serial.write(ring[dump_pos]);
+    dump_pos = (dump_pos + 1) & (FDR_LEN - 1);
+    dump_left -= 1;
+  }
+  if (!dump_left)
+    frozen = false;
+  return dump_left;
+}
+
+} // namespace Recorder
+
+#endif // RECORDER_H
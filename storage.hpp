@@ -0,0 +1,286 @@
+/*
+ * Persistent storage
+ * asynchronous EEPROM writes and journaled config records
+ */
+
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include "base.h"
+
+namespace Storage
+{
+
+/* ===== checksums ===== */
+
+// CRC16 (polynomial 0xA001) over a buffer
+uint16_t crc16(const void *buf, size_t len, uint16_t crc = 0xFFFF)
+{
+  const uint8_t *p = (const uint8_t *)buf;
+  for (size_t i = 0; i < len; i++)
+    crc = _crc16_update(crc, p[i]);
+  return crc;
+}
+
+/* ===== asynchronous EEPROM writes ===== */
+// NOTE: a byte write takes ~3.3 ms, so writes are queued and drained one
+//       byte at a time from the EE_READY interrupt. Bytes that already hold
+//       the right value are skipped (read-compare). Completion callbacks
+//       run from ee_update() in the main loop, not from the ISR.
+
+typedef struct EE_Job
+{
+  uint16_t addr;     // EEPROM destination address
+  uint8_t len;       // number of bytes
+  uint8_t pos;       // bytes processed so far (ISR)
+  uint8_t buf_i;     // start of the data in ee_buf
+  void (*done)(int); // completion callback (may be NULL)
+  int tag;           // passed to the callback
+} EE_Job;
+volatile EE_Job ee_jobs[EE_QUEUE_JOBS];
+volatile uint8_t ee_buf[EE_QUEUE_BUF];
+// job ring: [tail, active) complete, [active, head) queued
+volatile uint8_t ee_tail = 0, ee_active = 0, ee_head = 0;
+volatile uint8_t ee_buf_head = 0; // next free data byte
+volatile int ee_buf_used = 0;     // data bytes held by jobs
+unsigned long ee_bytes_written = 0, ee_bytes_skipped = 0; // statistics
+
+uint8_t ee_next(uint8_t i)
+{
+  return (i + 1) % EE_QUEUE_JOBS;
+}
+
+// queue a write of len bytes; data is copied, so the caller may reuse it
+// returns -1 if the queue or buffer is full
+int ee_write(uint16_t addr, const void *data, uint8_t len,
+             void (*done)(int) = NULL, int tag = 0)
+{
+  uint8_t sreg = SREG;
+  cli();
+  if (ee_next(ee_head) == ee_tail || ee_buf_used + len > EE_QUEUE_BUF)
+  {
+    SREG = sreg;
+    return -1;
+  }
+  SREG = sreg;
+  // NOTE: the slots claimed below are only touched by the ISR once
+  //       ee_head has been advanced
+  volatile EE_Job *job = ee_jobs + ee_head;
+  job->addr = addr;
+  job->len = len;
+  job->pos = 0;
+  job->buf_i = ee_buf_head;
+  job->done = done;
+  job->tag = tag;
+  const uint8_t *p = (const uint8_t *)data;
+  for (uint8_t i = 0; i < len; i++)
+    ee_buf[(ee_buf_head + i) % EE_QUEUE_BUF] = p[i];
+  cli();
+  ee_buf_head = (ee_buf_head + len) % EE_QUEUE_BUF;
+  ee_buf_used += len;
+  ee_head = ee_next(ee_head);
+  EECR |= _BV(EERIE); // (re)start draining
+  SREG = sreg;
+  return 0;
+}
+
+// drain the write queue; call from ISR(EE_READY_vect)
+// NOTE: EE_READY fires whenever no write is in progress, so at most one
+//       byte is written per call and the interrupt is disabled once idle
+void ee_isr()
+{
+  while (ee_active != ee_head)
+  {
+    volatile EE_Job *job = ee_jobs + ee_active;
+    while (job->pos < job->len)
+    {
+      uint8_t *addr = (uint8_t *)(job->addr + job->pos);
+      uint8_t v = ee_buf[(job->buf_i + job->pos) % EE_QUEUE_BUF];
+      job->pos += 1;
+      if (eeprom_read_byte(addr) != v)
+      {
+        eeprom_write_byte(addr, v); // returns without waiting
+        ee_bytes_written += 1;
+        return;
+      }
+      ee_bytes_skipped += 1;
+    }
+    ee_active = ee_next(ee_active); // job complete
+  }
+  EECR &= ~_BV(EERIE); // queue drained
+}
+
+// run callbacks of completed jobs and release their buffer space
+// NOTE: call from the main loop
+void ee_update()
+{
+  while (ee_tail != ee_active)
+  {
+    volatile EE_Job *job = ee_jobs + ee_tail;
+    void (*done)(int) = job->done;
+    int tag = job->tag;
+    uint8_t sreg = SREG;
+    cli();
+    ee_buf_used -= job->len;
+    ee_tail = ee_next(ee_tail);
+    SREG = sreg;
+    if (done)
+      done(tag);
+  }
+}
+
+// whether any write is queued, in progress or awaiting its callback
+bool ee_busy()
+{
+  return ee_tail != ee_head || (EECR & _BV(EEPE));
+}
+// whether ee_update() has callbacks to run
+bool ee_pending()
+{
+  return ee_tail != ee_active;
+}
+// write barrier: wait until all queued writes are on the EEPROM
+// NOTE: requires interrupts enabled
+void ee_flush()
+{
+  while (ee_busy())
+    ee_update();
+}
+
+// read a byte without disturbing a write in progress
+uint8_t ee_read(uint16_t addr)
+{
+  while (true)
+  {
+    uint8_t sreg = SREG;
+    cli();
+    if (!(EECR & _BV(EEPE))) // no write in progress; read now
+    {
+      uint8_t v = eeprom_read_byte((const uint8_t *)addr);
+      SREG = sreg;
+      return v;
+    }
+    SREG = sreg; // let the EE_READY ISR run meanwhile
+  }
+}
+
+/* ===== config journal ===== */
+// NOTE: the journal is a rotating append log of fixed-size records starting
+//       at CONFIG_ADDRESS. Each save goes to the slot after the latest one
+//       with the next sequence number, so no slot is rewritten until the
+//       whole log has wrapped around, and a torn write only ever damages
+//       the newest record (which then fails its CRC).
+
+typedef struct CT_ConfRecord
+{
+  uint16_t seq;   // sequence number, +1 per save
+  CT_Config conf; // config payload
+  uint16_t crc;   // CRC16 over seq and conf
+} CT_ConfRecord;
+const int CONF_REC_LEN = sizeof(CT_ConfRecord);
+const int CONF_SLOTS = CONFIG_JOURNAL_LEN / CONF_REC_LEN;
+
+int conf_slot = -1;    // slot of the latest valid record (-1: none)
+uint16_t conf_seq = 0; // sequence number of the latest valid record
+CT_Config conf_last;   // payload of the latest record
+
+int conf_addr(int slot)
+{
+  return CONFIG_ADDRESS + slot * CONF_REC_LEN;
+}
+uint16_t conf_crc(const CT_ConfRecord *r)
+{
+  // seed with the record length s.t. a layout change invalidates the log
+  return crc16(r, CONF_REC_LEN - sizeof(r->crc), CONF_REC_LEN);
+}
+// read a record; returns true if its CRC checks out
+bool conf_read_slot(int slot, CT_ConfRecord *r)
+{
+  uint8_t *p = (uint8_t *)r;
+  int addr = conf_addr(slot);
+  for (int i = 0; i < CONF_REC_LEN; i++)
+    p[i] = ee_read(addr + i);
+  return r->crc == conf_crc(r);
+}
+
+// locate the latest valid record; returns its slot or -1 if none
+// NOTE: slots [0, head] hold consecutive sequence numbers, so the head is
+//       found by binary search; falls back to a linear scan if slot 0 is
+//       damaged (e.g. power lost right after the log wrapped around)
+int conf_find_latest(CT_ConfRecord *r)
+{
+  CT_ConfRecord rec;
+  if (conf_read_slot(0, &rec))
+  {
+    uint16_t seq0 = rec.seq;
+    int lo = 0, hi = CONF_SLOTS - 1;
+    while (lo < hi)
+    {
+      int mid = (lo + hi + 1) / 2;
+      if (conf_read_slot(mid, &rec) && rec.seq == (uint16_t)(seq0 + mid))
+        lo = mid;
+      else
+        hi = mid - 1;
+    }
+    conf_read_slot(lo, r);
+    return lo;
+  }
+  int latest = -1;
+  for (int i = 1; i < CONF_SLOTS; i++)
+    if (conf_read_slot(i, &rec) &&
+        (latest < 0 || (int16_t)(rec.seq - r->seq) > 0))
+    {
+      latest = i;
+      *r = rec;
+    }
+  return latest;
+}
+
+// load the latest config; returns -1 (conf untouched) if there is none
+int conf_load(CT_Config *conf)
+{
+  CT_ConfRecord rec;
+  conf_slot = conf_find_latest(&rec);
+  if (conf_slot < 0)
+    return -1;
+  conf_seq = rec.seq;
+  memcpy(&conf_last, &rec.conf, CONFIG_LEN);
+  memcpy(conf, &rec.conf, CONFIG_LEN);
+  return 0;
+}
+
+// append a config record; skipped if conf equals the latest record
+// NOTE: queued on the asynchronous writer, which only writes the bytes
+//       that differ from the stale record being overwritten;
+//       returns -1 if the write queue is full (try again later)
+int conf_save(const CT_Config *conf, void (*done)(int) = NULL)
+{
+  if (conf_slot >= 0 && 0 == memcmp(&conf_last, conf, CONFIG_LEN))
+    return 0; // nothing changed
+  CT_ConfRecord rec;
+  rec.seq = conf_slot >= 0 ? conf_seq + 1 : 0;
+  memcpy(&rec.conf, conf, CONFIG_LEN);
+  rec.crc = conf_crc(&rec);
+  int slot = (conf_slot + 1) % CONF_SLOTS;
+  if (0 != ee_write(conf_addr(slot), &rec, CONF_REC_LEN, done, slot))
+    return -1;
+  conf_slot = slot;
+  conf_seq = rec.seq;
+  memcpy(&conf_last, conf, CONFIG_LEN);
+  return 0;
+}
+
+// invalidate the whole journal
+// NOTE: blocks until the journal is erased
+void conf_erase()
+{
+  ee_flush();
+  for (int i = 0; i < CONF_SLOTS * CONF_REC_LEN; i++)
+    EEPROM.update(CONFIG_ADDRESS + i, 0xFF);
+  conf_slot = -1;
+  conf_seq = 0;
+}
+
+} // namespace Storage
+
+#endif // STORAGE_H
@@ -7,11 +7,14 @@
 
 // C/C++ standard libs
 #include <math.h>
+#include <setjmp.h>
 #include <stdarg.h> // variable arguments
 #include <stdlib.h>
 #include <string.h>
 
 #include "base.h"
+#include "storage.hpp"
+#include "wheel.hpp"
 
 #define PORT_ON(port, pin) port |= (1 << pin)
 #define PORT_OFF(port, pin) port &= ~(1 << pin)
@@ -33,59 +36,134 @@ CT_Config *conf = NULL; // to be init'd from EEPROM or new instance
 // flags
 // TODO
 
+// screen update frequency, in Hz, and its timer (see isr.hpp)
+int disp_freq = INT_FREQ_1;
+int disp_timer = -1;
+
+// boot statistics
+uint8_t reset_cause = 0;   // MCUSR at boot
+bool warm_boot = false;    // state restored from the warm restart snapshot
+unsigned long boot_us = 0; // time from reset to the end of setup()
+
+// main loop statistics (current window)
+unsigned long stat_win_start = 0; // window start time, in microseconds
+unsigned long stat_idle_us = 0;   // time spent in idle sleep
+unsigned int stat_loops = 0;      // main loop passes
+unsigned int stat_sleeps = 0;     // idle sleeps entered
+// main loop statistics (last complete window)
+int duty_pm = 1000;          // busy time, in permille
+unsigned int loop_rate = 0;  // main loop passes per second
+unsigned int sleep_rate = 0; // idle sleeps per second
+
 /* ===== system functions ===== */
 
 /*
- * Setup Timer5 (Mega2560) for scheduled interrupts
+ * Setup Timer3 (Mega2560) for the 1 kHz timer wheel tick
+ * NOTE: register the periodic work first (see timers_init() in isr.hpp)
  */
 void timer_init()
 {
   cli();
 
-  // make sure Timer/Counter is not disabled by poewr saving
-  PRR1 = PRR1 & ~(_BV(PRTIM5));
-  PRR1 = PRR1 & ~(_BV(PRTIM4));
+  // make sure Timer/Counter is not disabled by power saving
+  PRR1 = PRR1 & ~(_BV(PRTIM3));
 
-  // put Timers into CTC mode (WGM5[3:0] = 0b0100), compare to OCR5A
-  TCCR5A = TCCR5A & ~(_BV(WGM51) | _BV(WGM50));
-  TCCR5B = (TCCR5B & ~_BV(WGM53)) | _BV(WGM52);
-  TCCR4A = TCCR4A & ~(_BV(WGM41) | _BV(WGM40));
-  TCCR4B = (TCCR4B & ~_BV(WGM43)) | _BV(WGM42);
+  // put Timer into CTC mode (WGM3[3:0] = 0b0100), compare to OCR3A
+  TCCR3A = TCCR3A & ~(_BV(WGM31) | _BV(WGM30));
+  TCCR3B = (TCCR3B & ~_BV(WGM33)) | _BV(WGM32);
 
-  // set prescalers
-  TCCR5B = ((TCCR5B | _BV(CS52)) & ~_BV(CS51)) | _BV(CS50);  //1024
-  TCCR4B = ((TCCR4B | _BV(CS42)) & ~_BV(CS41)) & ~_BV(CS40); // 256
+  // set prescaler
+  TCCR3B = ((TCCR3B & ~_BV(CS32)) | _BV(CS31)) | _BV(CS30); // 64
 
   // set output compare register
-  // NOTE: counter increments 1 per 1024 CPU cycle
-  OCR5A = F_CPU / (1024 * INT_FREQ_1);
-  OCR4A = F_CPU / (256 * INT_FREQ_2);
+  // NOTE: counter increments 1 per 64 CPU cycles, and wraps after OCR3A
+  OCR3A = F_CPU / (64UL * 1000) - 1;
 
-  // enable Timer5 compare match interrupt A
-  TIMSK5 = TIMSK5 | _BV(OCIE5A);
-  TIMSK4 = TIMSK4 | _BV(OCIE4A);
+  // enable Timer3 compare match interrupt A
+  TIMSK3 = TIMSK3 | _BV(OCIE3A);
 
   sei();
 }
+// reprogram the screen update frequency at runtime
+// NOTE: no-op if the frequency is unchanged; the update period is whole
+//       milliseconds, so rates that don't divide 1000 come out a bit high
+void set_disp_freq(int freq)
+{
+  if (freq < 1)
+    freq = 1;
+  if (freq > 1000)
+    freq = 1000;
+  if (freq == disp_freq)
+    return;
+  if (disp_timer >= 0)
+    Wheel::set_period(disp_timer, 1000 / freq);
+  disp_freq = freq;
+}
 void timer_sleep() // NOTE: Mega2560 specific
 {
-  PRR1 = PRR1 | _BV(PRTIM5);
-  PRR1 = PRR1 | _BV(PRTIM4);
+  PRR1 = PRR1 | _BV(PRTIM3);
 }
 void timer_wake() // NOTE: Mega2560 specific
 {
-  PRR1 = PRR1 & ~(_BV(PRTIM5));
-  PRR1 = PRR1 & ~(_BV(PRTIM4));
+  PRR1 = PRR1 & ~(_BV(PRTIM3));
 }
 
-// reading from / saving to persistent configs in flash
-void read_config()
+// put the CPU into idle sleep until the next interrupt
+// NOTE: call with interrupts disabled, right after checking for pending
+//       work; the instruction after sei() always runs before any ISR, so
+//       a wake-up cannot be lost between the check and the sleep
+void idle_sleep()
 {
-  // TODO
+  unsigned long t = micros();
+  set_sleep_mode(SLEEP_MODE_IDLE); // timers, SPI and USARTs keep running
+  sleep_enable();
+  sei();
+  sleep_cpu();
+  sleep_disable();
+  stat_idle_us += micros() - t; // ISR time during sleep counts as idle
+  stat_sleeps += 1;
 }
-void write_config()
+
+// update main loop statistics; call once per main loop pass
+void loop_stats_update()
 {
-  // TODO
+  stat_loops += 1;
+  unsigned long w = (micros() - stat_win_start) / 1000; // in milliseconds
+  if (w >= STAT_WINDOW_MS)
+  {
+    duty_pm = 1000 - (int)(stat_idle_us / w);
+    loop_rate = (unsigned long)stat_loops * 1000 / w;
+    sleep_rate = (unsigned long)stat_sleeps * 1000 / w;
+    stat_win_start = micros();
+    stat_idle_us = 0;
+    stat_loops = 0;
+    stat_sleeps = 0;
+  }
+}
+
+// reading from / saving to persistent configs in EEPROM
+// NOTE: RESET_EEPROM wipes the config journal; RESET_CONF discards the saved
+//       config and saves the defaults instead
+// NOTE: write_config() returns before the data is on the EEPROM;
+//       use Storage::ee_flush() as a barrier if needed
+int write_config()
+{
+  return Storage::conf_save(conf);
+}
+void read_config()
+{
+  if (!conf)
+    conf = new CT_Config; // defaults
+  if (RESET_EEPROM)
+    Storage::conf_erase();
+  if (RESET_CONF)
+  {
+    Storage::conf_load(conf); // locate the journal head only
+    *conf = CT_Config();
+    write_config();
+  }
+  else
+    Storage::conf_load(conf); // keeps defaults if nothing saved
 }
 
 void handle_exi() // handle external interrupt
@@ -93,8 +171,64 @@ void handle_exi() // handle external interrupt
   // TODO
 }
 
+/* ===== supervisor ===== */
+// NOTE: the watchdog runs in interrupt and reset mode around each verb
+//       and program call; the first timeout unwinds to the dispatcher
+//       (ISR(WDT_vect) -> sup_unwind()), a second one, e.g. with
+//       interrupts off for good, resets the system
+// NOTE: unwinding skips the rest of the call; whatever it was doing
+//       (a kRPC request, a malloc()) is left unfinished; an unfinished
+//       kRPC request leaves the link dirty (see Comm::xact_abort())
+
+jmp_buf sup_jmp;                 // dispatcher context to unwind to
+volatile bool sup_armed = false; // a call is being supervised
+bool resetting = false;          // reset_system() owns the watchdog
+unsigned int sup_overruns = 0;   // calls unwound so far
+int sup_verb = 0;                // last verb that overran
+int sup_pgm = 0;                 // last program that overran
+
+// start a call's time budget (one of the WDTO_* values)
+// NOTE: call after setjmp(sup_jmp)
+void sup_arm(uint8_t budget)
+{
+  if (resetting)
+    return;
+  uint8_t sreg = SREG;
+  cli();
+  wdt_reset();
+  WDTCSR = _BV(WDCE) | _BV(WDE); // timed sequence
+  WDTCSR = _BV(WDIE) | _BV(WDE) | (budget & 7) << WDP0 |
+           (budget & 8 ? _BV(WDP3) : 0);
+  sup_armed = true;
+  SREG = sreg;
+}
+// end a call's time budget
+void sup_disarm()
+{
+  sup_armed = false;
+  if (!resetting) // NOTE: a verb may have asked for a reset
+    wdt_disable();
+}
+// unwind the supervised call to its setjmp(); call from ISR(WDT_vect)
+void sup_unwind()
+{
+  if (!sup_armed)
+    return;
+  sup_disarm();
+  sup_overruns += 1;
+  longjmp(sup_jmp, 1); // restores SREG, i.e. interrupts back on
+}
+// not a safe point to unwind; wait for the next timeout
+// NOTE: the interrupt cleared WDIE; without it the next timeout resets
+void sup_defer()
+{
+  WDTCSR |= _BV(WDIE);
+}
+
 void reset_system()
 {
+  resetting = true; // keep the supervisor from disarming the reset
+  Storage::ee_flush(); // don't tear a pending EEPROM write
   // NOTE: the AVR watchdog timer, once enabled, forces hard system reset
   //       after the watchdog timer is triggered.
   wdt_enable(WDTO_15MS);
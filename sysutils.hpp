@@ -8,12 +8,16 @@
 #include "base.h"
 #include "system.hpp"
 #include "devices.hpp"
+#include "recorder.hpp"
 
 namespace SysUtils
 {
 
 /* ===== Input Window ===== */
 
+// a single numeric input field on one display row
+// NOTE: statically allocated and reused via open(); digits are parsed
+//       into acc_ as they are typed, so nothing is re-parsed at Enter
 class InputWindow
 {
 private:
@@ -22,12 +26,19 @@ private:
   Devices::Keypad_I *keypad_;
 
   // private members
-  char *inputbuf_;    // input buffer
-  int counter_ = 0;   // input character counter
-  int lc_addr_;       // input row index
-  int offset_;        // input row offset
-  int len_;           // input window length
-  bool allow_cursor_; // whether to allow cursor keys (for changing row)
+  char inputbuf_[LC_ROW_LEN + 1]; // input buffer (echo)
+  int counter_ = 0;               // input character counter
+  int lc_addr_;                   // input row index
+  int offset_;                    // input row offset
+  int len_;                       // input window length
+  bool allow_cursor_;             // whether to allow cursor keys
+  int dp_;                        // decimal places (IW_FIXED)
+  // incremental parser state
+  unsigned long acc_; // digits typed so far, as an integer
+  bool neg_;          // leading '-' typed
+  bool dot_;          // decimal point typed
+  int frac_;          // digits typed after the decimal point
+  bool shift_;        // IW_HEX: '.' typed, next digit 0-5 means A-F
 
 public:
   // public members
@@ -42,45 +53,97 @@ public:
   iw_status status_ = IW_INPUT;
   enum iw_mode // input mode
   {
-    IW_UL,   // unsigned long
-    IW_LONG, // long
-    IW_FLOAT // float
+    IW_UL,    // unsigned long
+    IW_LONG,  // long
+    IW_FLOAT, // float
+    IW_HEX,   // unsigned long, hex ('.' then 0-5 enters A-F)
+    IW_FIXED, // long, fixed-point scaled by 10^dp
+    IW_Q16    // Fixed::q16_t, saturated to the Q16.16 range
   };
   iw_mode mode_;
   void *p_res_; // return value pointer
 
-  InputWindow(void *p_res, int lc_addr, int offset, int len, iw_mode mode,
-              bool allow_cursor)
-      : p_res_{p_res}, lc_addr_{lc_addr}, offset_{offset}, len_{len},
-        mode_{mode}, allow_cursor_{allow_cursor}
+  // (re)initialize the input field and draw it
+  void open(void *p_res, int lc_addr, int offset, int len, iw_mode mode,
+            bool allow_cursor, int dp = 0)
   {
     lcd_ = Devices::lcd;
     keypad_ = Devices::keypad;
-    inputbuf_ = calloc(len * 2, sizeof(char)); // NOTE: remember to free!
-    memset(inputbuf_, '_', len_);
-
+    p_res_ = p_res;
+    lc_addr_ = lc_addr;
+    offset_ = offset;
+    len_ = len > LC_ROW_LEN ? LC_ROW_LEN : len;
+    mode_ = mode;
+    allow_cursor_ = allow_cursor;
+    dp_ = dp;
+    status_ = IW_INPUT;
+    clear_input();
+    draw(true);
+  }
+  void set_cursor(bool allow_cursor)
+  {
+    allow_cursor_ = allow_cursor;
+  }
+  // resume input after a cursor exit
+  void resume()
+  {
+    status_ = IW_INPUT;
+    draw(true);
+  }
+  // echo the input; empty positions show '_' only in the active field
+  void draw(bool active)
+  {
+    memset(inputbuf_ + counter_, active ? '_' : ' ', len_ - counter_);
+    int prev = lcd_->setLayer(Devices::L_IW); // draw over verbs and programs
     lcd_->printStr(lc_addr_, inputbuf_, offset_, len_, NULL, NULL);
+    lcd_->setLayer(prev);
   }
-  ~InputWindow()
+  // write the parsed value to the return value pointer
+  void commit()
   {
-    free(inputbuf_); // free input buffer
+    unsigned long scale = 1;
+    switch (mode_)
+    {
+    case IW_UL:
+    case IW_HEX:
+      *((unsigned long *)p_res_) = acc_;
+      break;
+    case IW_LONG:
+      *((long *)p_res_) = neg_ ? -(long)acc_ : (long)acc_;
+      break;
+    case IW_FLOAT:
+      for (int i = 0; i < frac_; i++)
+        scale *= 10;
+      *((double *)p_res_) = (neg_ ? -1.0 : 1.0) * acc_ / scale;
+      break;
+    case IW_FIXED:
+    {
+      for (int i = frac_; i < dp_; i++)
+        scale *= 10; // pad missing decimal places
+      // saturate instead of wrapping, e.g. 8 digits with dp = 2
+      long v = acc_ > INT32_MAX / scale ? INT32_MAX : (long)(acc_ * scale);
+      *((long *)p_res_) = neg_ ? -v : v;
+      break;
+    }
+    case IW_Q16:
+      for (int i = 0; i < frac_; i++)
+        scale *= 10;
+      *((Fixed::q16_t *)p_res_) =
+          Fixed::q16_from_ratio(neg_ ? -(long)acc_ : (long)acc_, scale);
+      break;
+    }
   }
 
   // process input according to iw_status
   // Note: the input window is only responsible for writing data and flags;
-  //       whoever instantiates the iw is responsible for destroying it
+  //       whoever opens the iw is responsible for closing it
   iw_status process_input(char k)
   {
     if (status_ == IW_INPUT) // only process input if in IW_INPUT state
     {
       if (k == M_ENTR_KEY)
       {
-        if (mode_ == IW_UL)
-          *((unsigned long *)p_res_) = (unsigned long)atol(inputbuf_);
-        else if (mode_ == IW_LONG)
-          *((long *)p_res_) = atol(inputbuf_);
-        else if (mode_ == IW_FLOAT)
-          *((double *)p_res_) = atof(inputbuf_);
+        commit();
         status_ = IW_COMPLETE;
         return IW_COMPLETE;
       }
@@ -92,10 +155,7 @@ public:
           return IW_EXIT;
         }
         else // input buffer not empty, clear input area
-        {
-          memset(inputbuf_, '_', len_);
-          counter_ = 0;
-        }
+          clear_input();
       }
       else if (allow_cursor_ && k == M_UP_KEY)
       {
@@ -107,29 +167,277 @@ public:
         status_ = IW_EXIT_DOWN;
         return IW_EXIT_DOWN;
       }
-      else if (isdigit(k) || (k == '.' && mode_ == IW_FLOAT) ||
-               (k == '-' && mode_ != IW_UL))
-      {
-        // if reached end of buffer, reset input area
-        if (counter_ == len_)
-        {
-          memset(inputbuf_, '_', len_);
-          counter_ = 0;
-        }
-        inputbuf_[counter_] = k;
-        counter_ += 1;
-      }
-      else // unrecognized key input, just return the current status
+      else if (!accept(k)) // unrecognized key input
         return status_;
       // middle of input session
       // print to screen directly, as the current row should be frozen
-      lcd_->printStr(lc_addr_, inputbuf_, offset_, len_, NULL, NULL);
+      draw(true);
       return IW_INPUT;
     }
     else // not in input state, do nothing
       return status_;
   }
+
+private:
+  void clear_input()
+  {
+    counter_ = 0;
+    acc_ = 0;
+    neg_ = dot_ = shift_ = false;
+    frac_ = 0;
+  }
+  // parse a character key; returns false if it is not valid here
+  bool accept(char k)
+  {
+    bool is_dec = mode_ == IW_FLOAT || mode_ == IW_FIXED || mode_ == IW_Q16;
+    bool is_signed = is_dec || mode_ == IW_LONG;
+    if (!(isdigit(k) || (k == '.' && (is_dec || mode_ == IW_HEX)) ||
+          (k == '-' && is_signed)))
+      return false;
+    // if reached end of buffer, reset input area
+    if (counter_ == len_)
+      clear_input();
+    if (k == '-') // sign only as the first character
+    {
+      if (counter_ != 0)
+        return false;
+      neg_ = true;
+    }
+    else if (k == '.' && mode_ == IW_HEX) // shift to A-F, not echoed
+    {
+      shift_ = !shift_;
+      return true;
+    }
+    else if (k == '.')
+    {
+      if (dot_)
+        return false;
+      dot_ = true;
+    }
+    else if (mode_ == IW_HEX)
+    {
+      int d = k - '0';
+      if (shift_)
+      {
+        if (d > 5)
+          return false;
+        d += 10;
+        k = 'A' + d - 10;
+        shift_ = false;
+      }
+      acc_ = acc_ * 16 + d;
+    }
+    else
+    {
+      if (dot_ && mode_ == IW_FIXED && frac_ >= dp_)
+        return false; // beyond the fixed-point precision
+      acc_ = acc_ * 10 + (k - '0');
+      frac_ += dot_ ? 1 : 0;
+    }
+    inputbuf_[counter_] = k;
+    counter_ += 1;
+    return true;
+  }
+};
+
+/* ===== Input Form ===== */
+
+// up to IW_MAX_FIELDS input fields edited together
+// NOTE: the cursor keys move between fields; Enter commits all fields,
+//       Exit on an empty field leaves the form
+class InputForm
+{
+public:
+  InputWindow::iw_status status_ = InputWindow::IW_INPUT; // form status
+
+  // remove all fields
+  void reset()
+  {
+    count_ = 0;
+    cursor_ = 0;
+    status_ = InputWindow::IW_INPUT;
+  }
+  // add a field; returns -1 if the form is full
+  int add_field(void *p_res, int lc_addr, int offset, int len,
+                InputWindow::iw_mode mode, bool allow_cursor, int dp)
+  {
+    if (count_ >= IW_MAX_FIELDS)
+      return -1;
+    fields_[count_].open(p_res, lc_addr, offset, len, mode, allow_cursor, dp);
+    if (count_ > 0) // cursor navigation between fields
+    {
+      fields_[count_].draw(false);
+      for (int i = 0; i <= count_; i++)
+        fields_[i].set_cursor(true);
+    }
+    count_ += 1;
+    return 0;
+  }
+  // pass a key to the field under the cursor
+  InputWindow::iw_status process_input(char k)
+  {
+    if (status_ != InputWindow::IW_INPUT || count_ == 0)
+      return status_;
+    InputWindow::iw_status s = fields_[cursor_].process_input(k);
+    if (s == InputWindow::IW_EXIT_UP || s == InputWindow::IW_EXIT_DOWN)
+    {
+      if (count_ > 1) // move to the previous/next field
+      {
+        fields_[cursor_].draw(false);
+        cursor_ = (cursor_ + (s == InputWindow::IW_EXIT_UP ? count_ - 1 : 1)) %
+                  count_;
+        fields_[cursor_].resume();
+      }
+      else // single field: let the owner handle the cursor exit
+        status_ = s;
+    }
+    else if (s == InputWindow::IW_COMPLETE)
+    {
+      for (int i = 0; i < count_; i++)
+        if (i != cursor_)
+          fields_[i].commit();
+      status_ = s;
+    }
+    else if (s == InputWindow::IW_EXIT)
+      status_ = s;
+    return status_;
+  }
+  int get_cursor()
+  {
+    return cursor_;
+  }
+
+private:
+  InputWindow fields_[IW_MAX_FIELDS];
+  int count_ = 0;  // number of fields
+  int cursor_ = 0; // field being edited
+};
+
+/* ===== wake-up queue ===== */
+
+// min-heap of verb/program wake-up deadlines (in millis)
+// NOTE: one entry per verb/program: pushing again replaces its entry, and
+//       stopping it removes it, so stale entries can't fill the queue
+// NOTE: the registry entry still holds the authoritative deadline; a
+//       popped wake-up that no longer matches its entry is simply dropped
+class WakeQueue
+{
+public:
+  struct wake_t
+  {
+    unsigned long deadline; // wake-up time, in milliseconds
+    bool pgm;               // true: program id; false: verb id
+    int id;                 // verb or program id
+  };
+
+  // add or move the wake-up of a verb/program; returns -1 if the queue
+  // is full
+  int push(unsigned long deadline, bool pgm, int id)
+  {
+    remove(pgm, id);
+    if (len_ >= WAKE_QUEUE_LEN)
+      return -1;
+    wake_t w = {deadline, pgm, id};
+    sift_up(len_++, w);
+    return 0;
+  }
+  // drop the wake-up of a verb/program, if any
+  void remove(bool pgm, int id)
+  {
+    for (int i = 0; i < len_; i++)
+      if (heap_[i].pgm == pgm && heap_[i].id == id)
+      {
+        wake_t last = heap_[--len_];
+        if (i == len_)
+          return;
+        if (i > 0 && before(last.deadline, heap_[(i - 1) / 2].deadline))
+          sift_up(i, last);
+        else
+          sift_down(i, last);
+        return;
+      }
+  }
+  // pop the earliest wake-up if it is due at time t
+  // returns false if nothing is due
+  bool pop_due(unsigned long t, wake_t *w)
+  {
+    if (len_ == 0 || before(t, heap_[0].deadline))
+      return false;
+    *w = heap_[0];
+    wake_t last = heap_[--len_];
+    if (len_)
+      sift_down(0, last);
+    return true;
+  }
+  int size()
+  {
+    return len_;
+  }
+  // whether the earliest wake-up is due at time t
+  bool due(unsigned long t)
+  {
+    return len_ > 0 && !before(t, heap_[0].deadline);
+  }
+
+private:
+  wake_t heap_[WAKE_QUEUE_LEN];
+  int len_ = 0;
+
+  // rollover-safe time comparison
+  static bool before(unsigned long a, unsigned long b)
+  {
+    return (long)(a - b) < 0;
+  }
+  // put w into hole i, moving it towards the root
+  void sift_up(int i, wake_t w)
+  {
+    while (i > 0 && before(w.deadline, heap_[(i - 1) / 2].deadline))
+    {
+      heap_[i] = heap_[(i - 1) / 2]; // sift parent down
+      i = (i - 1) / 2;
+    }
+    heap_[i] = w;
+  }
+  // put w into hole i, moving it towards the leaves
+  void sift_down(int i, wake_t w)
+  {
+    while (2 * i + 1 < len_)
+    {
+      int c = 2 * i + 1; // pick the earlier child
+      if (c + 1 < len_ && before(heap_[c + 1].deadline, heap_[c].deadline))
+        c += 1;
+      if (!before(heap_[c].deadline, w.deadline))
+        break;
+      heap_[i] = heap_[c]; // sift child up
+      i = c;
+    }
+    heap_[i] = w;
+  }
+};
+
+/* ===== warm restart snapshot ===== */
+
+// copy of the system state that survives watchdog and manual resets
+// NOTE: lives in .noinit SRAM, which the C runtime does not clear on reset;
+//       only trusted if the magic and CRC check out
+struct WarmState
+{
+  uint16_t magic;
+  int pvn_state[3];     // program, verb and noun
+  int pvn_state_pgm[3]; // program-requested p/v/n
+  uint8_t keyrel_req;   // key release request state
+  uint8_t n_pgm;        // number of entries in pgm
+  struct
+  {
+    uint8_t id;       // program id
+    int8_t status;    // program status
+    int stage;        // program stage
+    uint8_t data_len; // bytes of program data in data (0: not kept)
+  } pgm[WARM_MAX_PGM];
+  uint8_t data[WARM_DATA_LEN]; // program data blocks, back to back
+  uint16_t crc;
 };
+WarmState warm_state __attribute__((section(".noinit")));
 
 /* ===== system mananger ===== */
 
@@ -137,7 +445,7 @@ class SysManager
 {
 
 public:
-  InputWindow *iw_;       // input window pointer
+  InputForm *iw_;         // input window (form) pointer
   bool iw_open_ = false;  // input window open flag
   long pgm_exec_time = 0; // execution time of last program cycle
   enum keyrel_req_t       // key release request tracker
@@ -153,30 +461,43 @@ public:
   // ===== input window and UI managing =====
 
   // open an input window
-  // creates an InputWindow instance and pass all parameters
+  // sets up the (static) input form with a single field
   // NOTE: wrapper useful for keeping track of input window status
-  // NOTE: does NOT freeze the display; the caller is responsible
+  // NOTE: fields draw on their own display layer, over verbs and programs
+  // NOTE: dp is the number of decimal places for IW_FIXED
   int input_window_open(void *p_res, int lc_addr, int offset, int len,
-                        InputWindow::iw_mode mode, bool allow_cursor)
+                        InputWindow::iw_mode mode, bool allow_cursor,
+                        int dp = 0)
   {
     if (!iw_open_)
     {
-      iw_ = new InputWindow(p_res, lc_addr, offset, len, mode, allow_cursor);
+      iw_ = &iw_form_;
+      iw_->reset();
+      iw_->add_field(p_res, lc_addr, offset, len, mode, allow_cursor, dp);
       iw_open_ = true;
       return 0;
     }
     else // request rejected; caller should raise PGM ERR
       return -1;
   }
+  // add another field to the open input window
+  // NOTE: the cursor keys then move between fields
+  int input_window_add(void *p_res, int lc_addr, int offset, int len,
+                       InputWindow::iw_mode mode, int dp = 0)
+  {
+    if (!iw_open_)
+      return -1;
+    return iw_->add_field(p_res, lc_addr, offset, len, mode, true, dp);
+  }
   // close the input window
-  // deletes the InputWindow instance
-  // NOTE: does NOT unfreeze the display; caller is responsible
+  // NOTE: uncovers whatever the fields were drawn over
   int input_window_close()
   {
     if (iw_open_)
     {
-      delete iw_; // may unfreeze the display row
       iw_open_ = false;
+      lcd_->releaseLayer(Devices::L_IW);
+      post_event(EV_IW);
       return 0;
     }
     else // no input window is open
@@ -193,10 +514,17 @@ public:
     char k = keypad_->getKeyEvent(); // NOTE: allows next key input
     if (k)
     {
+      last_key_time_ = millis();
+      Recorder::event(Recorder::E_KEY, k);
       if (iw_open_) // if input window open, pass key event
-        iw_->process_input(k);
+      {
+        if (iw_->process_input(k) != InputWindow::IW_INPUT)
+          post_event(EV_IW); // entry finished; the owner may close it
+      }
       else // handle monitor UI
       {
+        if (verb_status_ != V_RUN) // a finished verb's rows were read
+          lcd_->releaseLayer(Devices::L_VERB);
         if (k == M_ENTR_KEY) // enter verb and noun
           vn_input_stage_ = VN_VERB;
         else if (k == M_EXIT_KEY) // clear error states
@@ -227,6 +555,7 @@ public:
     V_PGM_ERR = -1,
     V_OPR_ERR = -2
   } verb_status_ = V_COMPLETE;
+  static const int NUM_VN = 100; // verbs and nouns are two digits
   struct VDict_t // verb registry entry
   {
     bool valid = false;              // verb valid
@@ -234,16 +563,22 @@ public:
     void *data_ptr = NULL;           // data pointer
     int stage = 0;                   // verb stage
     bool has_noun = false;           // whether the verb requires a noun
+    uint8_t budget = SUP_BUDGET;     // time budget per call (WDTO_*)
+    bool sleeping = false;           // verb waiting for wake_at
+    unsigned long wake_at = 0;       // wake-up deadline, in milliseconds
   };
 
   // add a verb to the verb registry
-  int register_verb(int id, int (*verb_ptr)(int *, void **), bool has_noun)
+  // NOTE: a call running past budget (a WDTO_* value) ends in V_PGM_ERR
+  int register_verb(int id, int (*verb_ptr)(int *, void **), bool has_noun,
+                    uint8_t budget = SUP_BUDGET)
   {
     if (!v_dict_[id].valid) // verb not found in registry
     {
       v_dict_[id].valid = true;
       v_dict_[id].verb_ptr = verb_ptr;
       v_dict_[id].has_noun = has_noun;
+      v_dict_[id].budget = budget;
       return 0;
     }
     else // verb id already occupied
@@ -255,7 +590,6 @@ public:
   {
     if (vn_input_stage_ != VN_NULL) // verb/noun input active
     {
-      lcd_->setUpdate(0, false);      // freeze p/v/n display
       if (vn_input_stage_ == VN_VERB) // verb input
       {
         if (!iw_open_) // open new window if neccesary
@@ -267,7 +601,7 @@ public:
           if (!v_dict_[v_buf_].valid) // verb not found
           {
             vn_input_stage_ = VN_NULL;
-            status_led_->setStatus(LED_OPER_P, true); // operator error!
+            status_led_->setBlink(LED_OPER_P); // operator error!
           }
           else if (v_dict_[v_buf_].has_noun) // verb found, has noun
           {
@@ -304,8 +638,6 @@ public:
         }
       }
     }
-    else
-      lcd_->setUpdate(0, true); // unfreeze p/v/n display
   }
 
   // mark a verb-noun pair for execution
@@ -314,12 +646,12 @@ public:
   int set_vn(int v, int n)
   {
     // verb valid
-    if (v_dict_[v].valid)
+    if (v >= 0 && v < NUM_VN && n >= 0 && n < NUM_VN && v_dict_[v].valid)
     {
       // reinit
       stop_verb();
       v_dict_[v].stage = 0;
-      lcd_->clearDataRows(); // clear display on verb switch
+      lcd_->releaseLayer(Devices::L_VERB); // clear display on verb switch
       // set verb/noun
       pvn_state_[1] = v;
       pvn_state_[2] = n;
@@ -327,6 +659,7 @@ public:
       pvn_state_pgm_[2] = n;
       verb_status_ = V_RUN;      // set flag to allow verb running
       status_led_->clearError(); // clear error lights on v/n set
+      Recorder::event(Recorder::E_VN, v * 100 + n);
       return 0;
     }
     else // must be a pgm err; the usr can't enter invalid verbs
@@ -347,14 +680,18 @@ public:
   // NOTE: frees verb persistent memory, sets verb stage to 0;
   //       sets verb_status_ = V_COMPLETE;
   //       clears current verb and noun (set to 0)
+  // NOTE: keeps the verb's display layer, s.t. its results stay up; the
+  //       next set_vn() or operator key releases it
   void stop_verb()
   {
     free(v_dict_[pvn_state_[1]].data_ptr); // free verb memory
+    v_dict_[pvn_state_[1]].data_ptr = NULL;
     v_dict_[pvn_state_[1]].stage = 0;
+    v_dict_[pvn_state_[1]].sleeping = false;
+    wake_queue_.remove(false, pvn_state_[1]);
     verb_status_ = V_COMPLETE;
     pvn_state_[1] = 0; // reset v/n
     pvn_state_[2] = 0;
-    // lcd_->clearDataRows(); // clear on verb switch only
   }
 
   // execute the current verb in pvn_state_
@@ -379,15 +716,39 @@ public:
       {
         if (pvn_state_[2] && !v_dict_[v].has_noun)
           pvn_state_[2] = 0; // clear noun if current verb doesn't need one
-        if (verb_status_ == V_RUN)
-          verb_status_ = v_dict_[v].verb_ptr(&(v_dict_[v].stage),
-                                             &(v_dict_[v].data_ptr));
+        if (verb_status_ == V_RUN && v_dict_[v].sleeping)
+          return; // verb asleep, nothing to do until its wake-up
+        else if (verb_status_ == V_RUN)
+        {
+          int prev = lcd_->setLayer(Devices::L_VERB);
+          if (0 == setjmp(System::sup_jmp))
+          {
+            System::sup_arm(v_dict_[v].budget);
+            verb_status_ = v_dict_[v].verb_ptr(&(v_dict_[v].stage),
+                                               &(v_dict_[v].data_ptr));
+            System::sup_disarm();
+          }
+          else // over budget; unwound by the supervisor
+          {
+            System::sup_verb = v;
+            verb_status_ = V_PGM_ERR;
+            Recorder::event(Recorder::E_OVERRUN, v);
+          }
+          lcd_->setLayer(prev);
+          if (verb_status_ == V_PGM_ERR)
+            Recorder::event(Recorder::E_VERB_PGM_ERR, v);
+          else if (verb_status_ == V_OPR_ERR)
+            Recorder::event(Recorder::E_VERB_OPR_ERR, v);
+        }
         else if (verb_status_ == V_COMPLETE) // verb marked as complete
+        {
           stop_verb();
+          post_event(EV_VERB_DONE);
+        }
         else if (verb_status_ == V_PGM_ERR) // program error
           status_led_->setStatus(LED_PGER_P, true);
         else if (verb_status_ == V_OPR_ERR) // operator error
-          status_led_->setStatus(LED_OPER_P, true);
+          status_led_->setBlink(LED_OPER_P);
       }
     }
     else
@@ -414,15 +775,27 @@ public:
     int stage = 0;                    // program stage
     void *data_ptr = NULL;            // pointer to persistent data (free!)
     pgm_status_t status = P_COMPLETE; // program status flag
+    size_t data_len = 0;              // size of data block (warm restart)
+    uint8_t budget = SUP_BUDGET;      // time budget per step (WDTO_*)
+    bool sleeping = false;            // program waiting for wake_at
+    unsigned long wake_at = 0;        // wake-up deadline, in milliseconds
+    uint8_t wait_mask = 0;            // events to wait for (0: none)
   };
 
   // add a program to the program registry
-  int register_program(int id, int (*p_ptr)(int *, void **))
+  // NOTE: data_len is the size of the block the program keeps in data_ptr;
+  //       programs that declare it resume mid-stage after a warm restart,
+  //       others restart from stage 0
+  // NOTE: a step running past budget (a WDTO_* value) ends in P_PGM_ERR
+  int register_program(int id, int (*p_ptr)(int *, void **),
+                       size_t data_len = 0, uint8_t budget = SUP_BUDGET)
   {
     if (!p_dict_[id].valid) // verb not found in registry
     {
       p_dict_[id].valid = true;
       p_dict_[id].pgm_ptr = p_ptr;
+      p_dict_[id].data_len = data_len;
+      p_dict_[id].budget = budget;
       return 0;
     }
     else // program id already occupied
@@ -448,11 +821,13 @@ public:
         // TODO: potentially more logic
 
         // switch program
+        lcd_->releaseLayer(Devices::L_PGM); // the old program's rows
         pvn_state_[0] = id;
         pvn_state_pgm_[0] = id; // make sure we clear key release
         if (p_dict_[id].status != P_PAUSE)
           p_dict_[id].stage = 0; // i.e. if paused, just resume
         p_dict_[id].status = P_RUN;
+        Recorder::event(Recorder::E_PGM, id);
       }
       return 0;
     }
@@ -474,8 +849,14 @@ public:
     if (!p_dict_[pvn_state_[0]].valid) // pgm invalid
       return -1;
     free(p_dict_[pvn_state_[0]].data_ptr);      // free program storage
+    p_dict_[pvn_state_[0]].data_ptr = NULL;
     p_dict_[pvn_state_[0]].status = P_COMPLETE; // clear error flag
+    p_dict_[pvn_state_[0]].sleeping = false;
+    p_dict_[pvn_state_[0]].wait_mask = 0;
+    wake_queue_.remove(true, pvn_state_[0]);
     pvn_state_[0] = 0;                          // stop program
+    lcd_->releaseLayer(Devices::L_PGM);
+    Recorder::event(Recorder::E_PGM, 0);
     return 0;
   }
   // kill all programs, including paused ones
@@ -487,7 +868,11 @@ public:
       p_dict_[i].data_ptr = NULL;
       p_dict_[i].stage = 0;
       p_dict_[i].status = P_COMPLETE;
+      p_dict_[i].sleeping = false;
+      p_dict_[i].wait_mask = 0;
+      wake_queue_.remove(true, i);
     }
+    lcd_->releaseLayer(Devices::L_PGM);
   }
   // pause a program
   // NOTE: can't pause if program state not P_RUN (e.g. P_*_ERR)
@@ -533,12 +918,37 @@ public:
       {
         // run program
         PDict_t *curr_pgm = p_dict_ + pgm;
-        if (curr_pgm->status == P_RUN) // execute program
+        if (curr_pgm->status == P_RUN && !program_ready(curr_pgm))
+          pgm_exec_time = 0; // program asleep or waiting, skip
+        else if (curr_pgm->status == P_RUN) // execute program
         {
+          // deliver pending events; waits and sleeps are one-shot
+          events_ = events_pending_;
+          tlm_events_ = tlm_pending_;
+          events_pending_ = tlm_pending_ = 0;
+          curr_pgm->wait_mask = 0;
+          curr_pgm->sleeping = false;
           status_led_->setActivityLED(true); // only programs get ACT lgt
           pgm_exec_time = millis();          // time program execution
-          curr_pgm->status =
-              curr_pgm->pgm_ptr(&(curr_pgm->stage), &(curr_pgm->data_ptr));
+          int prev = lcd_->setLayer(Devices::L_PGM);
+          if (0 == setjmp(System::sup_jmp))
+          {
+            System::sup_arm(curr_pgm->budget);
+            curr_pgm->status =
+                curr_pgm->pgm_ptr(&(curr_pgm->stage), &(curr_pgm->data_ptr));
+            System::sup_disarm();
+          }
+          else // over budget; unwound by the supervisor
+          {
+            System::sup_pgm = pgm;
+            curr_pgm->status = P_PGM_ERR;
+            Recorder::event(Recorder::E_OVERRUN, 100 + pgm);
+          }
+          lcd_->setLayer(prev);
+          if (curr_pgm->status == P_PGM_ERR)
+            Recorder::event(Recorder::E_PGM_PGM_ERR, pgm);
+          else if (curr_pgm->status == P_OPR_ERR)
+            Recorder::event(Recorder::E_PGM_OPR_ERR, pgm);
           pgm_exec_time = millis() - pgm_exec_time;
           status_led_->setActivityLED(false);
         }
@@ -550,21 +960,224 @@ public:
         else if (curr_pgm->status == P_PGM_ERR) // program error
           status_led_->setStatus(LED_PGER_P, true);
         else if (curr_pgm->status == P_OPR_ERR) // operator error
-          status_led_->setStatus(LED_OPER_P, true);
+          status_led_->setBlink(LED_OPER_P);
       }
     }
     // else (null program) do nothing
   }
 
+  // ===== sleep/wake-up timers =====
+
+  // put the running verb to sleep until time t (in millis)
+  // NOTE: call from within a verb, then return V_RUN; the dispatcher skips
+  //       the verb until t. Stopping or switching the verb cancels the sleep
+  int sleep_verb_until(unsigned long t)
+  {
+    int v = pvn_state_[1];
+    if (!v || 0 != wake_queue_.push(t, false, v))
+      return -1; // no verb or queue full; the verb simply runs again
+    v_dict_[v].sleeping = true;
+    v_dict_[v].wake_at = t;
+    return 0;
+  }
+  int sleep_verb(unsigned long ms)
+  {
+    return sleep_verb_until(millis() + ms);
+  }
+  // put the running program to sleep until time t (in millis)
+  // NOTE: call from within a program, then return P_RUN
+  int sleep_program_until(unsigned long t)
+  {
+    int pgm = pvn_state_[0];
+    if (!pgm || 0 != wake_queue_.push(t, true, pgm))
+      return -1;
+    p_dict_[pgm].sleeping = true;
+    p_dict_[pgm].wake_at = t;
+    return 0;
+  }
+  int sleep_program(unsigned long ms)
+  {
+    return sleep_program_until(millis() + ms);
+  }
+  // wake up verbs and programs whose deadlines have passed
+  // NOTE: costs one comparison per cycle while nothing is due
+  void process_timers()
+  {
+    WakeQueue::wake_t w;
+    unsigned long t = millis();
+    while (wake_queue_.pop_due(t, &w))
+    {
+      if (w.pgm && p_dict_[w.id].sleeping &&
+          p_dict_[w.id].wake_at == w.deadline)
+      {
+        p_dict_[w.id].sleeping = false;
+        post_event(EV_TIMER);
+      }
+      else if (!w.pgm && v_dict_[w.id].sleeping &&
+               v_dict_[w.id].wake_at == w.deadline)
+        v_dict_[w.id].sleeping = false;
+      // else stale wake-up (entry stopped or re-armed), drop it
+    }
+  }
+
+  // ===== event bus =====
+  // NOTE: a program that calls wait_events() is only stepped again once
+  //       one of the events arrives, or its sleep expires if it also calls
+  //       sleep_program(), instead of polling on every cycle
+  // NOTE: events are edges, and a program can be stepped without one (e.g.
+  //       after a warm restart); re-check the state it depends on
+
+  enum event_t // event bits
+  {
+    EV_KYRL_ACC = 1 << 0,  // key release request accepted
+    EV_KYRL_REJ = 1 << 1,  // key release request rejected
+    EV_VERB_DONE = 1 << 2, // verb completed
+    EV_TLM = 1 << 3,       // telemetry channel updated, see tlm_events()
+    EV_TIMER = 1 << 4,     // program sleep expired
+    EV_IW = 1 << 5         // input window entry finished, or window closed
+  };
+  // queue an event for the current program
+  void post_event(uint8_t ev)
+  {
+    events_pending_ |= ev;
+  }
+  // queue a telemetry update of channel ch (0 to 7)
+  void post_tlm(int ch)
+  {
+    tlm_pending_ |= 1 << ch;
+    events_pending_ |= EV_TLM;
+  }
+  // wait for any of the events in mask; call from within a program, then
+  // return P_RUN
+  int wait_events(uint8_t mask)
+  {
+    int pgm = pvn_state_[0];
+    if (!pgm)
+      return -1;
+    p_dict_[pgm].wait_mask = mask;
+    return 0;
+  }
+  // events delivered to the running program step
+  uint8_t events()
+  {
+    return events_;
+  }
+  // telemetry channels updated since the last program step (bit mask)
+  uint8_t tlm_events()
+  {
+    return tlm_events_;
+  }
+
+  // ===== warm restart =====
+
+  // save the system state to the warm restart snapshot
+  void checkpoint()
+  {
+    WarmState *w = &warm_state;
+    w->magic = 0; // invalid while being written
+    memcpy(w->pvn_state, pvn_state_, sizeof(pvn_state_));
+    memcpy(w->pvn_state_pgm, pvn_state_pgm_, sizeof(pvn_state_pgm_));
+    w->keyrel_req = keyrel_req;
+    w->n_pgm = 0;
+    int data_i = 0;
+    for (int i = 1; i < 100 && w->n_pgm < WARM_MAX_PGM; i++)
+    {
+      if (!p_dict_[i].valid || p_dict_[i].status == P_COMPLETE)
+        continue;
+      int len = p_dict_[i].data_ptr ? p_dict_[i].data_len : 0;
+      if (data_i + len > WARM_DATA_LEN)
+        len = 0; // doesn't fit; program restarts from stage 0
+      w->pgm[w->n_pgm].id = i;
+      w->pgm[w->n_pgm].status = p_dict_[i].status;
+      w->pgm[w->n_pgm].stage = p_dict_[i].stage;
+      w->pgm[w->n_pgm].data_len = len;
+      memcpy(w->data + data_i, p_dict_[i].data_ptr, len);
+      data_i += len;
+      w->n_pgm += 1;
+    }
+    w->magic = WARM_MAGIC;
+    w->crc = Storage::crc16(w, sizeof(WarmState) - sizeof(w->crc));
+    last_checkpoint_ = millis();
+  }
+  // restore the system state from the warm restart snapshot
+  // NOTE: call after verbs and programs are registered;
+  //       returns -1 (nothing restored) if there is no valid snapshot
+  int restore_checkpoint()
+  {
+    WarmState *w = &warm_state;
+    if (w->magic != WARM_MAGIC || w->n_pgm > WARM_MAX_PGM ||
+        w->crc != Storage::crc16(w, sizeof(WarmState) - sizeof(w->crc)))
+      return -1;
+    int data_i = 0;
+    for (int i = 0; i < w->n_pgm; i++)
+    {
+      PDict_t *p = p_dict_ + w->pgm[i].id;
+      int len = w->pgm[i].data_len;
+      if (!p->valid)
+        continue;
+      if (len > 0 && len == (int)p->data_len) // resume mid-stage
+      {
+        p->data_ptr = malloc(len);
+        memcpy(p->data_ptr, w->data + data_i, len);
+        p->stage = w->pgm[i].stage;
+      }
+      else // data not kept, restart
+        p->stage = 0;
+      p->status = (pgm_status_t)w->pgm[i].status;
+      data_i += len;
+    }
+    pvn_state_[0] = w->pvn_state[0];
+    keyrel_req = (keyrel_req_t)w->keyrel_req;
+    if (w->pvn_state[1]) // verbs keep no state; restart the verb
+      set_vn(w->pvn_state[1], w->pvn_state[2]);
+    // NOTE: after set_vn(), which overwrites the verb/noun requests
+    memcpy(pvn_state_pgm_, w->pvn_state_pgm, sizeof(pvn_state_pgm_));
+    return 0;
+  }
+
+  // ===== main loop managing =====
+
+  // raise the screen update rate while the UI is in use
+  // NOTE: active while an input window is open or shortly after a key press
+  void update_disp_freq()
+  {
+    unsigned long idle_ms = millis() - last_key_time_;
+    bool active = iw_open_ ||
+                  idle_ms < (unsigned long)System::conf->disp_active_ms;
+    System::set_disp_freq(active ? System::conf->disp_freq_hi
+                                 : System::conf->disp_freq_lo);
+  }
+
+  // whether the next update() cycle has anything to do
+  // NOTE: the main loop idles the CPU until the next interrupt if not
+  bool has_pending_work()
+  {
+    if (keypad_->hasKeyEvent() || Serial.available() > 0)
+      return true;
+    if (wake_queue_.due(millis()) || Storage::ee_pending())
+      return true;
+    if (vn_input_stage_ != VN_NULL && !iw_open_)
+      return true; // next verb/noun input window still to be opened
+    int v = pvn_state_[1];
+    if (v && ((verb_status_ == V_RUN && !v_dict_[v].sleeping) ||
+              verb_status_ == V_COMPLETE))
+      return true;
+    PDict_t *p = &p_dict_[pvn_state_[0]];
+    if (pvn_state_[0] && ((p->status == P_RUN && program_ready(p)) ||
+                          p->status == P_COMPLETE))
+      return true;
+    return false;
+  }
+
   // update key release light according to request status
-  // if there is a key release request, light; else extinguish
+  // if there is a key release request, flash; else extinguish
   void update_key_rel()
   {
     // if requested, mark key release
     if (keyrel_req == KYRL_REQ_VN ||
         keyrel_req == KYRL_REQ_PGM ||
         keyrel_req == KYRL_REQ_PVN)
-      status_led_->setStatus(LED_KYRL_P, true);
+      status_led_->setBlink(LED_KYRL_P);
     else // clear key release
       status_led_->setStatus(LED_KYRL_P, false);
   }
@@ -612,6 +1225,7 @@ public:
           keyrel_req == KYRL_REQ_PVN)
         set_vn(pvn_state_pgm_[1], pvn_state_pgm_[2]); // set verb and noun
       keyrel_req = KYRL_ACC;
+      post_event(EV_KYRL_ACC);
     }
   }
   // reject key releast request
@@ -620,20 +1234,28 @@ public:
     if (keyrel_req == KYRL_REQ_VN ||
         keyrel_req == KYRL_REQ_PGM ||
         keyrel_req == KYRL_REQ_PVN)
+    {
       keyrel_req = KYRL_REJ;
+      post_event(EV_KYRL_REJ);
+    }
   }
 
   // do system manager cycle
   // should be called from the main loop
   void update() // the system manager reports to no one...
   {
+    process_timers();
     process_key_event();
     process_vn_input();
     lcd_->setPVN(0, pvn_state_); // set program, verb and noun display
 
     execute_verb(); // verb before program s.t. verb37 can work immediately
     step_program();
-    update_key_rel(); // update key release light
+    update_key_rel();     // update key release light
+    update_disp_freq();   // adapt screen update rate to UI activity
+    Storage::ee_update(); // finish asynchronous EEPROM writes
+    if (millis() - last_checkpoint_ >= WARM_CKPT_MS)
+      checkpoint(); // keep the warm restart snapshot fresh
   }
 
 private:
@@ -645,15 +1267,36 @@ private:
   // program/verb/noun selection managing
   int pvn_state_[3] = {0, 0, 0};     // Program, verb and noun states
   int pvn_state_pgm_[3] = {0, 0, 0}; // program-requested p/v/n states
+  unsigned long last_key_time_ = 0;  // time of the last key event
+  unsigned long last_checkpoint_ = 0; // time of the last warm snapshot
 
   // verb registry
-  VDict_t v_dict_[100]; // one entry for each verb
+  VDict_t v_dict_[NUM_VN]; // one entry for each verb
 
   // program registry
   // NOTE: since SysManager has the persistent storage pointer,
   //       we can safely kill the program whenever we want
   PDict_t p_dict_[100]; // one entry for each program
 
+  // pending verb/program wake-ups
+  WakeQueue wake_queue_;
+
+  // event bus
+  uint8_t events_pending_ = 0; // posted since the last program step
+  uint8_t tlm_pending_ = 0;
+  uint8_t events_ = 0; // delivered to the current program step
+  uint8_t tlm_events_ = 0;
+  // whether a running program is due for a step
+  bool program_ready(PDict_t *p)
+  {
+    if (p->wait_mask) // a sleep doubles as the timeout of a wait
+      return events_pending_ & (p->wait_mask | EV_TIMER);
+    return !p->sleeping;
+  }
+
+  // input window storage (no heap use)
+  InputForm iw_form_;
+
   // vern/noun input managing
   enum vn_in_stage // verb/noun input stage
   {
@@ -0,0 +1,250 @@
+/*
+ * Telemetry channels
+ * Slow, timestamped kRPC samples with per-channel extrapolation, so data
+ * rows update at display rate between samples
+ */
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include "base.h"
+#include "comm.hpp"
+#include "devices.hpp"
+#include "sysutils.hpp"
+#include "recorder.hpp"
+
+namespace Telemetry
+{
+
+/* ===== channel table ===== */
+
+enum channel_t // telemetry channels
+{
+  CH_ALT,    // mean altitude (m)
+  CH_RALT,   // surface (radar) altitude (m)
+  CH_VSPD,   // vertical speed (m/s)
+  CH_HSPD,   // horizontal speed (m/s)
+  CH_SPEED,  // surface speed (m/s)
+  CH_GFORCE, // g-force (g)
+  NUM_CH
+};
+
+enum order_t // extrapolation order
+{
+  HOLD,     // show the last sample
+  LINEAR,   // through the last two samples
+  QUADRATIC // through the last three samples
+};
+
+struct Channel
+{
+  uint8_t order;          // order_t
+  unsigned int period_ms; // sample period while the channel is in use
+  unsigned int stale_ms;  // estimates are flagged stale past this age
+  // samples, newest first
+  unsigned long t[TLM_DEPTH];
+  float x[TLM_DEPTH];
+  uint8_t n;              // valid samples
+  unsigned long next_at;  // time of the next sample
+  unsigned long last_use; // time of the last estimate(), for polling
+};
+
+// NOTE: altitude follows a ballistic arc between samples; speeds are
+//       close to linear over a sample period; g-force is too noisy
+Channel ch[NUM_CH] = {
+    {QUADRATIC, 500, 2000},
+    {QUADRATIC, 500, 2000},
+    {LINEAR, 500, 2000},
+    {LINEAR, 1000, 3000},
+    {LINEAR, 1000, 3000},
+    {HOLD, 1000, 3000}};
+
+// flight recorder units per channel unit, e.g. 10: 0.1 m/s steps
+// NOTE: keep in sync with tools/fdr_decode.py
+const int16_t rec_scale[NUM_CH] = {1, 1, 10, 10, 10, 100};
+unsigned long rec_at = 0; // time of the next recorder sample
+
+unsigned long samples = 0; // successful samples so far
+unsigned long errors = 0;  // failed samples so far
+
+/* ===== sampling ===== */
+
+// record a sample taken at time t
+void push(int c, unsigned long t, float x)
+{
+  Channel *p = &ch[c];
+  for (int i = TLM_DEPTH - 1; i > 0; i--)
+  {
+    p->t[i] = p->t[i - 1];
+    p->x[i] = p->x[i - 1];
+  }
+  p->t[0] = t;
+  p->x[0] = x;
+  if (p->n < TLM_DEPTH)
+    p->n += 1;
+  if (SysUtils::sys)
+    SysUtils::sys->post_tlm(c); // wake programs waiting on telemetry
+}
+
+// fetch a channel over kRPC; returns the error of the call that failed,
+// or KRPC_OK
+krpc_error_t fetch(int c, float *x)
+{
+  krpc_error_t err = Comm::open_flight();
+  if (KRPC_OK != err)
+    return err;
+  double d;
+  switch (c)
+  {
+  case CH_ALT:
+    err = krpc_SpaceCenter_Flight_MeanAltitude(Comm::conn, &d,
+                                               Comm::flight);
+    break;
+  case CH_RALT:
+    err = krpc_SpaceCenter_Flight_SurfaceAltitude(Comm::conn, &d,
+                                                   Comm::flight);
+    break;
+  case CH_VSPD:
+    err = krpc_SpaceCenter_Flight_VerticalSpeed(Comm::conn, &d,
+                                                Comm::flight);
+    break;
+  case CH_HSPD:
+    err = krpc_SpaceCenter_Flight_HorizontalSpeed(Comm::conn, &d,
+                                                   Comm::flight);
+    break;
+  case CH_SPEED:
+    err = krpc_SpaceCenter_Flight_Speed(Comm::conn, &d, Comm::flight);
+    break;
+  case CH_GFORCE:
+  {
+    float g;
+    err = krpc_SpaceCenter_Flight_GForce(Comm::conn, &g, Comm::flight);
+    d = g;
+    break;
+  }
+  default: // not a channel; nothing sent
+    return KRPC_ERROR_ENCODING_FAILED;
+  }
+  if (KRPC_OK != err)
+  {
+    Comm::close_flight(); // vessel may have changed; look it up again
+    return err;
+  }
+  *x = d;
+  return KRPC_OK;
+}
+
+// sample channel c now; returns 0 and the sample in *x, or -1
+int sample(int c, float *x)
+{
+  if (0 != Comm::xact_begin())
+    return -1;
+  if (0 != Comm::xact_end(fetch(c, x)))
+  {
+    errors += 1;
+    return -1;
+  }
+  push(c, millis(), *x);
+  samples += 1;
+  return 0;
+}
+
+// sample at most one due channel; call from the main loop
+// NOTE: kRPC calls block, so channels take turns; channels nobody has
+//       read for TLM_IDLE_MS aren't sampled at all
+void update()
+{
+  if (Comm::conn_state != Comm::CONN_UP)
+    return;
+  unsigned long t = millis();
+  for (int c = 0; c < NUM_CH; c++)
+  {
+    Channel *p = &ch[c];
+    if (t - p->last_use > TLM_IDLE_MS || (long)(t - p->next_at) < 0)
+      continue;
+    float x;
+    sample(c, &x); // NOTE: a failed sample waits a period too
+    p->next_at = t + p->period_ms;
+    return;
+  }
+}
+
+// feed the flight recorder every FDR_PERIOD_MS; call from the main loop
+// NOTE: records the latest samples of the channels in use, as they are;
+//       estimating would keep idle channels awake
+void record()
+{
+  unsigned long t = millis();
+  if ((long)(t - rec_at) < 0)
+    return;
+  rec_at = t + FDR_PERIOD_MS;
+  int32_t x[NUM_CH];
+  uint8_t mask = 0;
+  for (int c = 0; c < NUM_CH; c++)
+  {
+    Channel *p = &ch[c];
+    x[c] = 0;
+    if (p->n && t - p->last_use <= TLM_IDLE_MS)
+    {
+      x[c] = lround(p->x[0] * rec_scale[c]);
+      mask |= 1 << c;
+    }
+  }
+  if (mask) // none in use, e.g. with the link down: nothing to record
+    Recorder::sample(mask, x, NUM_CH);
+}
+
+/* ===== estimation ===== */
+
+// estimate a channel at time t; returns true if the estimate is fresh
+// NOTE: extrapolation stops at the staleness cutoff, so a dead link
+//       doesn't run the value away
+bool estimate(int c, unsigned long t, float *x)
+{
+  Channel *p = &ch[c];
+  if (p->last_use == 0 || t - p->last_use > TLM_IDLE_MS)
+  {
+    p->n = 0; // channel wakes up; drop old samples and sample right away
+    p->next_at = t;
+  }
+  p->last_use = t;
+  if (p->n == 0)
+  {
+    *x = 0;
+    return false;
+  }
+  unsigned long age = t - p->t[0];
+  bool fresh = age <= p->stale_ms;
+  float s = (fresh ? age : p->stale_ms) / 1000.0; // time since the sample
+  int order = p->order < p->n - 1 ? p->order : p->n - 1;
+  // sample times relative to the newest sample, in seconds
+  float t1 = order > HOLD ? -(long)(p->t[0] - p->t[1]) / 1000.0 : 0;
+  float t2 = order > LINEAR ? -(long)(p->t[0] - p->t[2]) / 1000.0 : 0;
+  if (t1 == 0) // same-millisecond samples carry no slope
+    *x = p->x[0];
+  else if (order == LINEAR || t2 == t1)
+    *x = p->x[0] + (p->x[1] - p->x[0]) * s / t1;
+  else // Lagrange polynomial through the last three samples
+    *x = p->x[0] * (s - t1) * (s - t2) / (t1 * t2) +
+         p->x[1] * s * (s - t2) / (t1 * (t1 - t2)) +
+         p->x[2] * s * (s - t1) / (t2 * (t2 - t1));
+  return fresh;
+}
+
+// print a channel to a data row with dp decimals; flash the row if stale
+void show(int addr, int c, int dp)
+{
+  float x, scale = 1;
+  bool fresh = estimate(c, millis(), &x);
+  for (int i = 0; i < dp; i++)
+    scale *= 10;
+  if (ch[c].n)
+    Devices::lcd->setScaled(addr, lround(x * scale), dp);
+  else
+    Devices::lcd->clear(addr);
+  Devices::lcd->setFlash(addr, !fresh);
+}
+
+} // namespace Telemetry
+
+#endif // TELEMETRY_H
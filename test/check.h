@@ -0,0 +1,37 @@
+/*
+ * Host test helpers
+ * NOTE: the tests in this directory build with a host compiler against
+ *       the headers that don't need Arduino, e.g.
+ *         g++ -std=gnu++11 -I.. fixed_test.cpp -o fixed_test
+ *       and exit non-zero if a check fails
+ */
+
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <stdio.h>
+
+int check_count = 0, check_failures = 0;
+
+// count a check; print it with its message if it fails
+#define CHECK(cond, ...)                                                    \
+  do                                                                        \
+  {                                                                         \
+    check_count += 1;                                                       \
+    if (!(cond))                                                            \
+    {                                                                       \
+      check_failures += 1;                                                  \
+      printf("FAIL %s:%d: ", __FILE__, __LINE__);                           \
+      printf(__VA_ARGS__);                                                  \
+      printf("\n");                                                         \
+    }                                                                       \
+  } while (0)
+
+// print the summary; returns the exit code
+inline int check_done(const char *name)
+{
+  printf("%s: %d checks, %d failed\n", name, check_count, check_failures);
+  return check_failures ? 1 : 0;
+}
+
+#endif // CHECK_H
@@ -0,0 +1,137 @@
+/*
+ * fixed.hpp accuracy tests, against the host's libm
+ * NOTE: build: g++ -std=gnu++11 -I.. fixed_test.cpp -o fixed_test
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "fixed.hpp"
+#include "check.h"
+
+using namespace Fixed;
+
+const double LSB = 1.0 / 65536; // Q16.16 resolution
+
+double d(q16_t a)
+{
+  return q16_to_double(a);
+}
+double d32(q32_t a)
+{
+  return (double)a / 4294967296.0;
+}
+
+void test_conversions()
+{
+  CHECK(q16_from_int(40000) == Q16_MAX, "from_int saturates high");
+  CHECK(q16_from_int(-40000) == Q16_MIN, "from_int saturates low");
+  CHECK(q16_to_int(q16_from_double(-2.75)) == -2, "to_int rounds to 0");
+  CHECK(fabs(d(q16_from_ratio(553, 10)) - 55.3) <= LSB, "from_ratio");
+  CHECK(q16_from_ratio(1, 0) == Q16_MAX, "from_ratio / 0");
+  for (double x = -32000; x < 32000; x += 12.345)
+    CHECK(fabs(d(q16_from_double(x)) - x) <= LSB / 2, "round trip %f", x);
+}
+
+void test_arithmetic()
+{
+  CHECK(q16_add(Q16_MAX, Q16_ONE) == Q16_MAX, "add saturates high");
+  CHECK(q16_add(Q16_MIN, -Q16_ONE) == Q16_MIN, "add saturates low");
+  CHECK(q16_sub(Q16_MIN, Q16_ONE) == Q16_MIN, "sub saturates low");
+  CHECK(q16_sub(Q16_MAX, -Q16_ONE) == Q16_MAX, "sub saturates high");
+  CHECK(q16_mul(q16_from_int(300), q16_from_int(300)) == Q16_MAX,
+        "mul saturates");
+  CHECK(q16_div(Q16_ONE, 0) == Q16_MAX, "div / 0");
+  CHECK(q16_abs(Q16_MIN) == Q16_MAX, "abs of min");
+  for (double a = -181; a < 181; a += 0.731)
+    for (double b = -181; b < 181; b += 1.37)
+    {
+      q16_t qa = q16_from_double(a), qb = q16_from_double(b);
+      double ea = d(qa), eb = d(qb);
+      CHECK(fabs(d(q16_mul(qa, qb)) - ea * eb) <= LSB / 2, "mul %f %f", a,
+            b);
+      if (fabs(eb) > 0.01 && fabs(ea / eb) < 32000)
+        CHECK(fabs(d(q16_div(qa, qb)) - ea / eb) <= LSB, "div %f %f", a, b);
+    }
+}
+
+void test_q32()
+{
+  CHECK(q32_add(Q32_MAX, Q32_ONE) == Q32_MAX, "q32 add saturates");
+  CHECK(q32_mul(q32_from_int(100000), q32_from_int(100000)) == Q32_MAX,
+        "q32 mul saturates");
+  CHECK(q32_div(Q32_ONE, 0) == Q32_MAX, "q32 div / 0");
+  for (double a = -3e4; a < 3e4; a += 731.3)
+    for (double b = -3e4; b < 3e4; b += 977.7)
+    {
+      q32_t qa = (q32_t)(a * 4294967296.0), qb = (q32_t)(b * 4294967296.0);
+      long double p = (long double)d32(qa) * d32(qb);
+      CHECK(fabsl(d32(q32_mul(qa, qb)) - p) <= fabsl(p) * 1e-15 + 1e-9,
+            "q32 mul %f %f", a, b);
+      long double q = (long double)d32(qa) / d32(qb);
+      CHECK(fabsl(d32(q32_div(qa, qb)) - q) <= fabsl(q) * 1e-15 + 1e-9,
+            "q32 div %f %f", a, b);
+    }
+}
+
+void test_functions()
+{
+  CHECK(q16_sqrt(-Q16_ONE) == 0, "sqrt of negative");
+  for (double x = 0; x < 32767; x = x * 1.01 + 0.001)
+    CHECK(fabs(d(q16_sqrt(q16_from_double(x))) - sqrt(d(q16_from_double(x))))
+              <= LSB,
+          "sqrt %f", x);
+  for (double a = -20; a < 20; a += 0.0123)
+  {
+    q16_t s, c;
+    q16_sincos(q16_from_double(a), &s, &c);
+    CHECK(fabs(d(s) - sin(a)) < 4e-4 && fabs(d(c) - cos(a)) < 4e-4,
+          "sincos %f: %f %f", a, d(s), d(c));
+  }
+  for (double a = -M_PI; a < M_PI; a += 0.0173)
+    for (double r = 1e-3; r < 3e4; r *= 7.3)
+    {
+      double x = r * cos(a), y = r * sin(a);
+      q16_t qx = q16_from_double(x), qy = q16_from_double(y);
+      if (!qx && !qy)
+        continue;
+      // against the angle of the quantized vector; 2 pi wraps to 0
+      double ref = atan2(d(qy), d(qx)), err = d(q16_atan2(qy, qx)) - ref;
+      err = fabs(remainder(err, 2 * M_PI));
+      double tol = 4e-4 + 2 * LSB / hypot(d(qx), d(qy));
+      CHECK(err < tol, "atan2 %f %f: err %g", y, x, err);
+    }
+  // extremes: -Q16_MIN overflows, see q16_atan2()
+  const q16_t ext[] = {Q16_MIN, Q16_MIN + 1, -1, 0, 1, Q16_MAX};
+  for (q16_t y : ext)
+    for (q16_t x : ext)
+    {
+      if (!x && !y)
+        continue;
+      double ref = atan2((double)y, (double)x);
+      double err = fabs(remainder(d(q16_atan2(y, x)) - ref, 2 * M_PI));
+      CHECK(err < 1e-3, "atan2 extreme %d %d: err %g", y, x, err);
+    }
+}
+
+void test_format()
+{
+  char buf[8];
+  bool dots[8];
+  q16_format(q16_from_double(-12.5), buf, dots, 7);
+  CHECK(0 == memcmp(buf, "-125000", 7) && dots[2], "format -12.5");
+  q16_format(q16_from_double(0.25), buf, dots, 7);
+  CHECK(0 == memcmp(buf, " 250000", 7) && dots[0], "format 0.25");
+  q16_format(q16_from_double(123.456), buf, dots, 7);
+  CHECK(0 == memcmp(buf, " 123456", 7) && dots[3], "format 123.456");
+}
+
+int main()
+{
+  test_conversions();
+  test_arithmetic();
+  test_q32();
+  test_functions();
+  test_format();
+  return check_done("fixed");
+}
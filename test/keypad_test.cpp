@@ -0,0 +1,210 @@
+/*
+ * keypad.hpp tests against scripted scans
+ * Debouncing, hold/repeat and the event queue, one update() per scan
+ * NOTE: build: g++ -std=gnu++11 -I.. keypad_test.cpp -o keypad_test
+ * NOTE: tick counts follow base.h at INT_FREQ_2 = 200 Hz; key 3 and 7
+ *       repeat, as M_UP_KEY and M_DOWN_KEY do on the default keymap
+ */
+
+#include "keypad.hpp"
+#include "check.h"
+
+using namespace Devices;
+
+const uint16_t HOLD = 120;  // KEYPAD_HOLD_MS 600
+const uint16_t REPEAT = 30; // KEYPAD_REPEAT_MS 150
+const uint8_t QUEUE_LEN = 8;
+const uint16_t REPEAT_KEYS = 1 << 3 | 1 << 7;
+
+typedef KeyEvents<16, HOLD, REPEAT, QUEUE_LEN> Keys;
+
+// scan the same raw keys n times
+void scan(Keys *k, uint16_t raw, int n)
+{
+  for (int i = 0; i < n; i++)
+    k->update(raw);
+}
+
+// pop every queued event into evs; returns the count
+int drain(Keys *k, uint8_t *evs, int max)
+{
+  int n = 0;
+  uint8_t ev;
+  while ((ev = k->getEvent()))
+    if (n < max)
+      evs[n++] = ev;
+  return n;
+}
+
+// a key changes state after 4 consistent scans; contact bounce of
+// fewer never gets through
+void test_bounce()
+{
+  Keys k(REPEAT_KEYS);
+  uint8_t evs[QUEUE_LEN];
+  for (int n = 1; n < 4; n++) // bounce shorter than the debounce time
+  {
+    scan(&k, 1 << 5, n);
+    scan(&k, 0, 4);
+    CHECK(!k.hasKeyEvent(), "%d-scan blip queued an event", n);
+    CHECK(k.keys() == 0, "%d-scan blip: keys %04x", n, k.keys());
+  }
+  // closing contact: down, up, down... then down for good
+  static const uint16_t close[] = {1, 0, 1, 1, 0, 1, 1, 1, 0, 1, 1, 1, 1};
+  for (unsigned i = 0; i < sizeof(close) / sizeof(close[0]); i++)
+  {
+    k.update(close[i] << 5);
+    CHECK(k.hasKeyEvent() == (i == sizeof(close) / sizeof(close[0]) - 1),
+          "press at scan %u", i);
+  }
+  int n = drain(&k, evs, QUEUE_LEN);
+  CHECK(n == 1 && evs[0] == (KEY_PRESS | 5), "%d events, first %02x", n,
+        evs[0]);
+  // opening contact bounce doesn't release it
+  static const uint16_t open[] = {0, 1, 0, 0, 1, 0, 0, 0, 1, 0, 0, 0, 0};
+  for (unsigned i = 0; i < sizeof(open) / sizeof(open[0]); i++)
+    k.update(open[i] << 5);
+  n = drain(&k, evs, QUEUE_LEN);
+  CHECK(n == 1 && evs[0] == (KEY_RELEASE | 5), "%d events, first %02x", n,
+        evs[0]);
+  CHECK(k.keys() == 0, "keys %04x after release", k.keys());
+}
+
+// any number of keys may be down at once; each one gets its own press
+// and release, in scan order
+void test_rollover()
+{
+  Keys k(REPEAT_KEYS);
+  uint8_t evs[QUEUE_LEN];
+  scan(&k, 1 << 0, 4);
+  scan(&k, 1 << 0 | 1 << 9, 4);
+  scan(&k, 1 << 0 | 1 << 9 | 1 << 15, 4);
+  CHECK(k.keys() == (1 << 0 | 1 << 9 | 1 << 15), "keys %04x", k.keys());
+  scan(&k, 1 << 9 | 1 << 15, 4); // first key up with the others held
+  scan(&k, 0, 4);
+  static const uint8_t want[] = {KEY_PRESS | 0,    KEY_PRESS | 9,
+                                 KEY_PRESS | 15,   KEY_RELEASE | 0,
+                                 KEY_RELEASE | 9,  KEY_RELEASE | 15};
+  int n = drain(&k, evs, QUEUE_LEN);
+  CHECK(n == sizeof(want), "%d events, not %d", n, (int)sizeof(want));
+  for (int i = 0; i < n && i < (int)sizeof(want); i++)
+    CHECK(evs[i] == want[i], "event %d: %02x, not %02x", i, evs[i], want[i]);
+  // keys pressed on the same scan
+  scan(&k, 1 << 2 | 1 << 12, 4);
+  n = drain(&k, evs, QUEUE_LEN);
+  CHECK(n == 2 && evs[0] == (KEY_PRESS | 2) && evs[1] == (KEY_PRESS | 12),
+        "%d events: %02x %02x", n, evs[0], evs[1]);
+}
+
+// a key held HOLD scans after its press gets one hold event
+void test_hold()
+{
+  Keys k(REPEAT_KEYS);
+  uint8_t evs[QUEUE_LEN];
+  scan(&k, 1 << 1, 4); // pressed on the 4th scan
+  drain(&k, evs, QUEUE_LEN);
+  scan(&k, 1 << 1, HOLD - 1);
+  CHECK(!k.hasKeyEvent(), "hold before %u scans", HOLD);
+  k.update(1 << 1);
+  int n = drain(&k, evs, QUEUE_LEN);
+  CHECK(n == 1 && evs[0] == (KEY_HOLD | 1), "%d events, first %02x", n,
+        evs[0]);
+  scan(&k, 1 << 1, 10 * REPEAT); // not a repeating key
+  CHECK(!k.hasKeyEvent(), "key 1 repeated");
+  // released short of the hold
+  scan(&k, 0, 4);
+  drain(&k, evs, QUEUE_LEN);
+  scan(&k, 1 << 1, 4 + HOLD - 5);
+  scan(&k, 0, 4);
+  n = drain(&k, evs, QUEUE_LEN);
+  CHECK(n == 2 && evs[0] == (KEY_PRESS | 1) && evs[1] == (KEY_RELEASE | 1),
+        "%d events: %02x %02x", n, evs[0], evs[1]);
+  // the hold follows the last key pressed
+  scan(&k, 1 << 1, 4 + 50);
+  scan(&k, 1 << 1 | 1 << 6, 4 + HOLD);
+  n = drain(&k, evs, QUEUE_LEN);
+  CHECK(n == 3 && evs[2] == (KEY_HOLD | 6), "%d events, last %02x", n,
+        evs[n - 1]);
+}
+
+// held cursor keys repeat every REPEAT scans after the hold; others don't
+void test_repeat()
+{
+  static const uint8_t keys[] = {3, 7, 0, 4, 11};
+  for (unsigned j = 0; j < sizeof(keys); j++)
+  {
+    Keys k(REPEAT_KEYS);
+    uint8_t evs[QUEUE_LEN];
+    uint8_t key = keys[j];
+    bool repeats = REPEAT_KEYS & (1 << key);
+    scan(&k, 1 << key, 4 + HOLD);
+    drain(&k, evs, QUEUE_LEN);
+    int reps = 0;
+    for (int t = 1; t <= 5 * REPEAT; t++)
+    {
+      k.update(1 << key);
+      int n = drain(&k, evs, QUEUE_LEN);
+      CHECK(n == (repeats && t % REPEAT == 0),
+            "key %u: %d events at %d scans after the hold", key, n, t);
+      if (n)
+      {
+        CHECK(evs[0] == (KEY_REPEAT | key), "key %u: event %02x", key,
+              evs[0]);
+        reps += 1;
+      }
+    }
+    CHECK(reps == (repeats ? 5 : 0), "key %u: %d repeats", key, reps);
+    scan(&k, 0, 4);
+    scan(&k, 0, 2 * REPEAT); // released: no more
+    int n = drain(&k, evs, QUEUE_LEN);
+    CHECK(n == 1 && evs[0] == (KEY_RELEASE | key), "key %u: %d events", key,
+          n);
+  }
+}
+
+// a full queue drops new events and counts them; what's queued survives
+void test_overflow()
+{
+  Keys k(REPEAT_KEYS);
+  uint8_t evs[QUEUE_LEN];
+  // one slot stays empty: QUEUE_LEN - 1 events fit
+  for (int i = 0; i < 6; i++)
+  {
+    scan(&k, 1 << i, 4);
+    scan(&k, 0, 4);
+  }
+  CHECK(k.overflows == 12 - (QUEUE_LEN - 1), "%u overflows",
+        k.overflows);
+  int n = drain(&k, evs, QUEUE_LEN);
+  CHECK(n == QUEUE_LEN - 1, "%d events queued", n);
+  for (int i = 0; i < n; i++)
+  {
+    uint8_t want = (i & 1 ? KEY_RELEASE : KEY_PRESS) | i / 2;
+    CHECK(evs[i] == want, "event %d: %02x, not %02x", i, evs[i], want);
+  }
+  // room again after reading
+  scan(&k, 1 << 9, 4);
+  n = drain(&k, evs, QUEUE_LEN);
+  CHECK(n == 1 && evs[0] == (KEY_PRESS | 9), "%d events after drain", n);
+  CHECK(k.overflows == 12 - (QUEUE_LEN - 1), "%u overflows", k.overflows);
+  // the queue wraps around
+  for (int r = 0; r < 3 * QUEUE_LEN; r++)
+  {
+    scan(&k, 1 << 9 | 1 << 10, 4);
+    scan(&k, 1 << 9, 4);
+    n = drain(&k, evs, QUEUE_LEN);
+    CHECK(n == 2 && evs[0] == (KEY_PRESS | 10) &&
+              evs[1] == (KEY_RELEASE | 10),
+          "round %d: %d events", r, n);
+  }
+}
+
+int main()
+{
+  test_bounce();
+  test_rollover();
+  test_hold();
+  test_repeat();
+  test_overflow();
+  return check_done("keypad_test");
+}
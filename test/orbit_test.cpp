@@ -0,0 +1,248 @@
+/*
+ * orbit.hpp tests against reference orbits
+ * Elements from from_state() are checked against closed-form values, and
+ * propagate() against a numerically integrated two-body trajectory
+ * NOTE: build: g++ -std=gnu++11 -I.. orbit_test.cpp -o orbit_test
+ * NOTE: host doubles are 64-bit; on the Mega they are 32-bit, so the
+ *       reference orbits run again in float, at float tolerances
+ */
+
+#include <float.h>
+#include <math.h>
+
+#include "orbit.hpp"
+#include "check.h"
+
+using namespace Orbit;
+
+const double MU = 3.5316e12; // Kerbin
+const double R = 600000;
+
+// relative or absolute closeness
+bool near(double a, double b, double rel, double abs_tol = 0)
+{
+  return fabs(a - b) <= fabs(b) * rel + abs_tol;
+}
+
+// reference trajectory: RK4 on the two-body equations of motion
+void accel(const double *r, double *a)
+{
+  double k = -MU / pow(dot(r, r), 1.5);
+  for (int i = 0; i < 3; i++)
+    a[i] = k * r[i];
+}
+void rk4(double *r, double *v, double h)
+{
+  double k1r[3], k1v[3], k2r[3], k2v[3], k3r[3], k3v[3], k4r[3], k4v[3];
+  double t[3];
+  for (int i = 0; i < 3; i++)
+    k1r[i] = v[i];
+  accel(r, k1v);
+  for (int i = 0; i < 3; i++)
+  {
+    k2r[i] = v[i] + k1v[i] * h / 2;
+    t[i] = r[i] + k1r[i] * h / 2;
+  }
+  accel(t, k2v);
+  for (int i = 0; i < 3; i++)
+  {
+    k3r[i] = v[i] + k2v[i] * h / 2;
+    t[i] = r[i] + k2r[i] * h / 2;
+  }
+  accel(t, k3v);
+  for (int i = 0; i < 3; i++)
+  {
+    k4r[i] = v[i] + k3v[i] * h;
+    t[i] = r[i] + k3r[i] * h;
+  }
+  accel(t, k4v);
+  for (int i = 0; i < 3; i++)
+  {
+    r[i] += (k1r[i] + 2 * k2r[i] + 2 * k3r[i] + k4r[i]) * h / 6;
+    v[i] += (k1v[i] + 2 * k2v[i] + 2 * k3v[i] + k4v[i]) * h / 6;
+  }
+}
+
+// state at periapsis pe (radius) with eccentricity e, in an inclined plane
+State periapsis_state(double pe, double e)
+{
+  double v = sqrt(MU * (1 + e) / pe), inc = 0.3;
+  State s = {{pe, 0, 0}, {0, v * cos(inc), v * sin(inc)}, MU, R};
+  return s;
+}
+
+// a state in scalar type T
+template <typename T>
+StateT<T> to(const State &s)
+{
+  StateT<T> t = {{(T)s.r[0], (T)s.r[1], (T)s.r[2]},
+                 {(T)s.v[0], (T)s.v[1], (T)s.v[2]},
+                 (T)s.mu,
+                 (T)s.radius};
+  return t;
+}
+
+// propagate() in T against the integrated trajectory for duration s
+// seconds, checking the altitude every step s / n; tol relative to the
+// radius
+template <typename T>
+void check_track(const char *name, const State &s, double secs, int n,
+                 double tol)
+{
+  ElementsT<T> el;
+  CHECK(0 == from_state(to<T>(s), 1000, &el), "%s: from_state", name);
+  double r[3] = {s.r[0], s.r[1], s.r[2]}, v[3] = {s.v[0], s.v[1], s.v[2]};
+  const double h = 0.5; // integration step, s
+  double t = 0;
+  for (int k = 1; k <= n; k++)
+  {
+    for (; t < secs * k / n - 1e-9; t += h)
+      rk4(r, v, h);
+    DerivedT<T> d;
+    propagate(el, 1000 + (unsigned long)(t * 1000 + 0.5), &d);
+    double ref = sqrt(dot(r, r));
+    CHECK(near(d.alt + R, ref, tol), "%s: alt at %.0f s: %.1f, want %.1f",
+          name, t, d.alt, ref - R);
+  }
+}
+
+// Kepler's equation within KEPLER_ITER, up to e close to 1
+void test_kepler()
+{
+  const double es[] = {0, 0.3, 0.8, 0.99, 0.999, 0.999999};
+  for (double e : es)
+    for (double m = 1e-7; m < TWO_PI_D; m *= 1.05)
+    {
+      double x = solve_kepler(m, e);
+      CHECK(fabs(x - e * sin(x) - m) < 1e-9, "kepler e %g m %g", e, m);
+    }
+  const double hs[] = {1.000001, 1.001, 1.5, 5};
+  for (double e : hs)
+    for (double m = 1e-7; m < 1e3; m *= 1.1)
+    {
+      double x = solve_kepler(m, e), y = solve_kepler(-m, e);
+      CHECK(fabs(e * sinh(x) - x - m) < 1e-9 * (1 + m) && y == -x,
+            "kepler e %g m %g", e, m);
+    }
+}
+
+void test_circular()
+{
+  double a = R + 100000;
+  State s = periapsis_state(a, 0);
+  Elements el;
+  Derived d;
+  CHECK(0 == from_state(s, 0, &el), "circular: from_state");
+  propagate(el, 0, &d);
+  double period = 2 * M_PI * sqrt(a * a * a / MU);
+  CHECK(el.e < 1e-9, "circular: e %g", el.e);
+  CHECK(near(d.ap_alt, 100000, 0, 0.01) && near(d.pe_alt, 100000, 0, 0.01),
+        "circular: ap %f pe %f", d.ap_alt, d.pe_alt);
+  CHECK(near(d.period, period, 1e-9), "circular: period %f", d.period);
+  check_track<double>("circular", s, period, 12, 1e-7);
+}
+
+void test_eccentric()
+{
+  double pe = R + 100000, ap = R + 2000000;
+  double e = (ap - pe) / (ap + pe), a = (ap + pe) / 2;
+  double period = 2 * M_PI * sqrt(a * a * a / MU);
+  State s = periapsis_state(pe, e);
+  Elements el;
+  Derived d;
+  CHECK(0 == from_state(s, 0, &el), "eccentric: from_state");
+  propagate(el, 0, &d);
+  CHECK(near(el.e, e, 1e-9), "eccentric: e %f, want %f", el.e, e);
+  CHECK(near(d.ap_alt, ap - R, 1e-9) && near(d.pe_alt, pe - R, 1e-9),
+        "eccentric: ap %f pe %f", d.ap_alt, d.pe_alt);
+  CHECK(near(d.period, period, 1e-9), "eccentric: period %f", d.period);
+  CHECK(near(d.t_ap, period / 2, 1e-9), "eccentric: t_ap %f", d.t_ap);
+  // half a period on: at apoapsis, periapsis next
+  propagate(el, (unsigned long)(period / 2 * 1000), &d);
+  CHECK(near(d.alt, ap - R, 1e-6), "eccentric: alt at ap %f", d.alt);
+  CHECK(near(d.nu, M_PI, 0, 1e-3), "eccentric: nu at ap %f", d.nu);
+  check_track<double>("eccentric", s, period * 1.5, 24, 1e-6);
+  // elements from a sample away from periapsis describe the same orbit
+  double r[3] = {s.r[0], s.r[1], s.r[2]}, v[3] = {s.v[0], s.v[1], s.v[2]};
+  for (int k = 0; k < 1234 * 2; k++)
+    rk4(r, v, 0.5);
+  State s2 = {{r[0], r[1], r[2]}, {v[0], v[1], v[2]}, MU, R};
+  CHECK(0 == from_state(s2, 0, &el), "eccentric: from_state later");
+  propagate(el, 0, &d);
+  CHECK(near(d.ap_alt, ap - R, 1e-6) && near(d.pe_alt, pe - R, 1e-6),
+        "eccentric later: ap %f pe %f", d.ap_alt, d.pe_alt);
+  CHECK(near(d.t_pe, period - 1234, 1e-6), "eccentric later: t_pe %f",
+        d.t_pe);
+}
+
+void test_near_parabolic()
+{
+  double pe = R + 80000;
+  check_track<double>("e 0.999", periapsis_state(pe, 0.999), 3600, 12,
+                      1e-5);
+  check_track<double>("e 1.001", periapsis_state(pe, 1.001), 3600, 12,
+                      1e-5);
+  // exactly parabolic: nudged to barely bound, still tracks near pe
+  check_track<double>("e 1", periapsis_state(pe, 1), 1800, 6, 1e-4);
+  Elements el;
+  Derived d;
+  from_state(periapsis_state(pe, 1.2), 0, &el);
+  propagate(el, 0, &d);
+  CHECK(isnan(d.ap_alt) && isnan(d.period) && near(d.pe_alt, pe - R, 1e-9),
+        "hyperbolic: ap %f period %f pe %f", d.ap_alt, d.period, d.pe_alt);
+  // radial trajectory: no orbit
+  State radial = {{pe, 0, 0}, {100, 0, 0}, MU, R};
+  CHECK(-1 == from_state(radial, 0, &el) && !el.valid, "radial");
+}
+
+// the above in float, as on the Mega: Kepler's equation within a few
+// float steps of the exact anomaly up to e close to 1, elements to float
+// precision, and the reference orbits within a few meters
+void test_float()
+{
+  const double es[] = {0, 0.3, 0.8, 0.99, 0.999, 0.999999, 1.000001,
+                       1.001, 1.5, 5};
+  for (double e : es)
+    for (double m = 1e-7; m < (e < 1 ? TWO_PI_D : 1e3); m *= 1.05)
+    {
+      float fm = m, fe = e; // solve the same equation in both
+      double x = solve_kepler(fm, fe), want = solve_kepler<double>(fm, fe);
+      CHECK(fabs(x - want) <= 8 * FLT_EPSILON * want,
+            "float kepler e %g m %g: %.9g, want %.9g", e, m, x, want);
+    }
+  double pe = R + 100000, ap = R + 2000000;
+  double e = (ap - pe) / (ap + pe), a = (ap + pe) / 2;
+  double period = 2 * M_PI * sqrt(a * a * a / MU);
+  State s = periapsis_state(pe, e);
+  ElementsT<float> el;
+  DerivedT<float> d;
+  CHECK(0 == from_state(to<float>(s), 0, &el), "float: from_state");
+  propagate(el, 0, &d);
+  CHECK(near(el.e, e, 4 * FLT_EPSILON), "float: e %.9f, want %.9f", el.e,
+        e);
+  CHECK(near(d.ap_alt, ap - R, 1e-6) && near(d.pe_alt, pe - R, 1e-6),
+        "float: ap %f pe %f", d.ap_alt, d.pe_alt);
+  CHECK(near(d.period, period, 1e-6), "float: period %f", d.period);
+  CHECK(near(d.t_ap, period / 2, 1e-6), "float: t_ap %f", d.t_ap);
+  CHECK(near(d.nu, 0, 0, 1e-6), "float: nu at pe %g", d.nu);
+  double c = R + 100000;
+  check_track<float>("float circular", periapsis_state(c, 0),
+                     2 * M_PI * sqrt(c * c * c / MU), 12, 1e-6);
+  check_track<float>("float eccentric", s, period * 1.5, 24, 4e-6);
+  pe = R + 80000;
+  check_track<float>("float e 0.999", periapsis_state(pe, 0.999), 3600, 12,
+                     1e-6);
+  check_track<float>("float e 1.001", periapsis_state(pe, 1.001), 3600, 12,
+                     1e-6);
+  check_track<float>("float e 1", periapsis_state(pe, 1), 1800, 6, 4e-6);
+}
+
+int main()
+{
+  test_kepler();
+  test_circular();
+  test_eccentric();
+  test_near_parabolic();
+  test_float();
+  return check_done("orbit");
+}
@@ -0,0 +1,175 @@
+/*
+ * pid.hpp tests against a plant model
+ * The vertical speed and altitude holds of control.hpp, stepped at the
+ * loop rate against a point mass under gravity and a throttled engine
+ * NOTE: build: g++ -std=gnu++11 -I.. pid_test.cpp -o pid_test
+ * NOTE: rate, gains and limits are the flight ones, from gains.hpp
+ */
+
+#include <math.h>
+
+#include "gains.hpp"
+#include "check.h"
+
+using namespace Control;
+using namespace Fixed;
+
+const int RATE_HZ = CTL_RATE_HZ;
+const q16_t DT = Q16_ONE / RATE_HZ;
+const double G = 9.81;
+const double TWR = 2; // hover at half throttle
+
+// a fresh controller, as Control::start() sets one up
+void init(Pid *p, const Gains &g)
+{
+  *p = Pid();
+  pid_init(p, g);
+}
+
+// a point mass going straight up or down
+struct Plant
+{
+  double h, vs, th;
+  void step(double dt)
+  {
+    vs += (TWR * G * th - G) * dt;
+    h += vs * dt;
+  }
+};
+
+// engage the altitude hold as Control::hold_alt() does: the vertical
+// speed loop takes over at the current speed and throttle, the altitude
+// loop from the current speed
+struct AltHold
+{
+  Pid alt, vspd;
+  q16_t sp, vsp;
+  void engage(const Plant &p, double target)
+  {
+    init(&vspd, VSPD_GAINS);
+    init(&alt, ALT_GAINS);
+    pid_reset(&vspd, q16_from_double(p.th));
+    pid_reset(&alt, q16_from_double(p.vs));
+    sp = q16_from_double(target / ALT_GAINS.unit);
+  }
+  void step(Plant *p)
+  {
+    vsp = pid_step(&alt, sp, q16_from_double(p->h / ALT_GAINS.unit), DT);
+    p->th = q16_to_double(pid_step(&vspd, vsp, q16_from_double(p->vs), DT));
+    p->step(1.0 / RATE_HZ);
+  }
+};
+
+// altitude hold engaged while climbing: no setpoint bias from the speed
+// at engagement (a P-only loop must not keep a seeded integral)
+void test_engage_climbing()
+{
+  Plant p = {5000, 15, 0.6};
+  AltHold c;
+  c.engage(p, 5000);
+  double th0 = p.th, vs_max = 0;
+  for (int k = 0; k < 180 * RATE_HZ; k++)
+  {
+    double th = p.th;
+    c.step(&p);
+    CHECK(fabs(p.th - th) <= 0.5 / RATE_HZ + 1e-4, "throttle slew %g at %d",
+          p.th - th, k);
+    if (k == 0)
+      CHECK(fabs(p.th - th0) <= 0.5 / RATE_HZ + 1e-4,
+            "takeover bump %g -> %g", th0, p.th);
+    if (fabs(p.vs) > vs_max)
+      vs_max = fabs(p.vs);
+  }
+  CHECK(fabs(p.h - 5000) < 0.5, "settled at %.2f m, not 5000", p.h);
+  CHECK(fabs(p.vs) < 0.05, "still moving at %.3f m/s", p.vs);
+  CHECK(c.alt.integ == 0, "P-only integral %g", q16_to_double(c.alt.integ));
+  CHECK(vs_max <= 20.5, "vertical speed reached %.2f m/s", vs_max);
+}
+
+// altitude setpoint steps, up and down
+void test_alt_steps()
+{
+  static const double steps[][2] = {
+      {1000, 1500}, {1500, 1000}, {80, 3000}, {3000, 2990}};
+  for (unsigned i = 0; i < sizeof(steps) / sizeof(steps[0]); i++)
+  {
+    Plant p = {steps[i][0], 0, 0.5};
+    AltHold c;
+    c.engage(p, steps[i][1]);
+    double dir = steps[i][1] > steps[i][0] ? 1 : -1, over = 0;
+    for (int k = 0; k < 600 * RATE_HZ; k++)
+    {
+      c.step(&p);
+      double o = (p.h - steps[i][1]) * dir;
+      if (o > over)
+        over = o;
+    }
+    CHECK(fabs(p.h - steps[i][1]) < 0.5, "%g -> %g settled at %.2f",
+          steps[i][0], steps[i][1], p.h);
+    CHECK(over < 0.05 * fabs(steps[i][1] - steps[i][0]) + 1,
+          "%g -> %g overshoot %.2f m", steps[i][0], steps[i][1], over);
+  }
+}
+
+// vertical speed hold: bumpless takeover, then tracking
+void test_vspd()
+{
+  static const double sps[] = {0, 10, -5, 20};
+  for (unsigned i = 0; i < sizeof(sps) / sizeof(sps[0]); i++)
+  {
+    Plant p = {1000, 3, 0.7};
+    Pid c;
+    init(&c, VSPD_GAINS);
+    pid_reset(&c, q16_from_double(p.th));
+    q16_t sp = q16_from_double(sps[i]);
+    for (int k = 0; k < 120 * RATE_HZ; k++)
+    {
+      double th = q16_to_double(pid_step(&c, sp, q16_from_double(p.vs), DT));
+      // NOTE: one step of integral action, or the slew limit where the
+      //       proportional term alone is out of the output range
+      if (k == 0)
+        CHECK(fabs(th - p.th) <= fabs(sps[i] - p.vs) / 20 / RATE_HZ + 1e-3 ||
+                  fabs(th - p.th) <= 0.5 / RATE_HZ + 1e-4,
+              "takeover bump %g -> %g", p.th, th);
+      p.th = th;
+      p.step(1.0 / RATE_HZ);
+      CHECK(c.integ >= c.out_min && c.integ <= c.out_max,
+            "integral %g out of limits", q16_to_double(c.integ));
+    }
+    CHECK(fabs(p.vs - sps[i]) < 0.05, "speed %.3f, not %g", p.vs, sps[i]);
+    CHECK(fabs(p.th - 0.5) < 0.01, "throttle %.3f, not hover", p.th);
+  }
+}
+
+// anti-windup: a setpoint out of reach saturates the output without
+// winding the integral up, and the loop recovers once it is back
+void test_windup()
+{
+  Plant p = {1000, 0, 0.5};
+  Pid c;
+  init(&c, VSPD_GAINS);
+  pid_reset(&c, q16_from_double(p.th));
+  for (int k = 0; k < 60 * RATE_HZ; k++) // can't climb without engine
+  {
+    p.th = q16_to_double(pid_step(&c, Q16_ONE * 10, q16_from_double(p.vs),
+                                  DT));
+    p.vs = 0; // e.g. still clamped to the pad
+  }
+  CHECK(p.th > 0.999, "throttle %g, not saturated", p.th);
+  CHECK(c.integ <= c.out_max, "integral %g", q16_to_double(c.integ));
+  for (int k = 0; k < 30 * RATE_HZ; k++)
+  {
+    p.th = q16_to_double(pid_step(&c, 0, q16_from_double(p.vs), DT));
+    p.step(1.0 / RATE_HZ);
+  }
+  CHECK(fabs(p.vs) < 0.1, "not recovered: %.3f m/s", p.vs);
+}
+
+int main()
+{
+  test_engage_climbing();
+  test_alt_steps();
+  test_vspd();
+  test_windup();
+  return check_done("pid_test");
+}
@@ -0,0 +1,180 @@
+#!/usr/bin/env python3
+"""Decode an LDSKY flight data recorder dump (see recorder.hpp) to CSV.
+
+Usage:
+  fdr_decode.py --port /dev/ttyACM0 -o flight.csv   wait for a dump
+  fdr_decode.py dump.bin -o flight.csv              decode a saved dump
+
+With --port, start verb 74 on the panel (or type "vn 74 0" on the
+console and accept with KEY REL) once the decoder is waiting. --raw
+saves the dump as received.
+
+NOTE: a Mega resets when its USB serial port is opened with DTR set.
+The decoder opens the port with DTR off, but some OS drivers raise it
+on open anyway (on Linux, "stty -F /dev/ttyACM0 -hupcl" once keeps it
+down). The recording survives such a reset (it lives in .noinit SRAM);
+the dump then starts with a "boot" event, and times restart from 0.
+
+One CSV row per record: the time in seconds since boot, then either the
+telemetry channels of a sample (empty if not in use) or an event and
+its value. Records older than the oldest keyframe in the ring carry no
+time base and are skipped.
+"""
+
+import argparse
+import csv
+import struct
+import sys
+
+# NOTE: keep in sync with Telemetry::channel_t and Telemetry::rec_scale
+CHANNELS = [("alt", 1), ("ralt", 1), ("vspd", 10), ("hspd", 10),
+            ("speed", 10), ("gforce", 100)]
+MAX_CH = 8
+# NOTE: keep in sync with Recorder::event_t
+EVENTS = ["key", "vn", "pgm", "verb_pgm_err", "verb_opr_err",
+          "pgm_pgm_err", "pgm_opr_err", "overrun", "boot"]
+R_KEY, R_SAMPLE, R_EVENT = 1, 2, 3
+
+
+def crc16(data, crc=0xFFFF):
+    # same as avr-libc _crc16_update()
+    for b in data:
+        crc ^= b
+        for _ in range(8):
+            crc = (crc >> 1) ^ 0xA001 if crc & 1 else crc >> 1
+    return crc
+
+
+class Reader:
+    def __init__(self, data):
+        self.data, self.pos = data, 0
+
+    def byte(self):
+        self.pos += 1
+        return self.data[self.pos - 1]
+
+    def varint(self):
+        v, shift = 0, 0
+        while True:
+            b = self.byte()
+            v |= (b & 0x7F) << shift
+            shift += 7
+            if not b & 0x80:
+                return v
+
+    def signed(self):
+        v = self.varint()
+        return (v >> 1) ^ -(v & 1)
+
+
+def decode(data):
+    """Yield (time in ms, channel values or None, event, value)."""
+    r = Reader(data)
+    t = None  # no time base before the first keyframe
+    x = [0] * MAX_CH
+    while r.pos < len(data):
+        tag = r.byte()
+        if tag == R_KEY:
+            t = r.varint()
+            mask = r.byte()
+            x = [r.signed() for _ in range(MAX_CH)]
+            if not mask:  # time base only, e.g. at boot
+                continue
+        elif tag == R_SAMPLE:
+            dt = r.varint()
+            mask = r.byte()
+            for c in range(MAX_CH):
+                if mask & 1 << c:
+                    x[c] += r.signed()
+            if t is None:
+                continue
+            t += dt
+        elif tag == R_EVENT:
+            dt = r.varint()
+            kind = r.byte()
+            value = r.signed()
+            if t is None:
+                continue
+            t += dt
+            name = EVENTS[kind] if kind < len(EVENTS) else str(kind)
+            if kind == 0:  # key char
+                value = chr(value)
+            yield t, None, name, value
+            continue
+        else:
+            raise ValueError("bad record tag %d at byte %d" % (tag, r.pos - 1))
+        yield t, [(x[c] / s if s > 1 else x[c]) if mask & 1 << c else None
+                  for c, (_, s) in enumerate(CHANNELS)], "", ""
+
+
+def unframe(raw):
+    """Find the dump in raw serial data; returns the records."""
+    i = raw.find(b"FD")
+    while i >= 0 and len(raw) >= i + 6:
+        length, crc = struct.unpack("<HH", raw[i + 2:i + 6])
+        body = raw[i + 6:i + 6 + length]
+        if len(body) == length and crc16(body) == crc:
+            return body
+        i = raw.find(b"FD", i + 1)
+    sys.exit("no complete dump found")
+
+
+def receive(port, timeout):
+    import serial  # pyserial
+
+    s = serial.Serial()  # not opened yet, s.t. DTR can be set first
+    s.port = port
+    s.baudrate = 115200
+    s.timeout = timeout
+    s.dtr = False  # DTR pulses reset the Mega
+    s.open()
+    with s:
+        print("waiting for verb 74 ...", file=sys.stderr)
+        raw = b""
+        while True:
+            chunk = s.read(256)
+            if not chunk:
+                if b"FD" in raw:
+                    return raw  # dump over, or stalled
+                continue
+            raw += chunk
+            i = raw.find(b"FD")
+            if i >= 0 and len(raw) >= i + 6:
+                length = struct.unpack("<H", raw[i + 2:i + 4])[0]
+                if len(raw) >= i + 6 + length:
+                    return raw
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    src = ap.add_mutually_exclusive_group(required=True)
+    src.add_argument("dump", nargs="?", help="saved dump (raw serial data)")
+    src.add_argument("--port", help="serial port to receive the dump on")
+    ap.add_argument("-o", "--output", help="CSV file (default: stdout)")
+    ap.add_argument("--raw", help="with --port, also save the dump here")
+    ap.add_argument("--timeout", type=float, default=2.0,
+                    help="seconds of silence that end a dump")
+    args = ap.parse_args()
+    if args.port:
+        raw = receive(args.port, args.timeout)
+        if args.raw:
+            with open(args.raw, "wb") as f:
+                f.write(raw)
+    else:
+        with open(args.dump, "rb") as f:
+            raw = f.read()
+    body = unframe(raw)
+    out = open(args.output, "w", newline="") if args.output else sys.stdout
+    w = csv.writer(out)
+    w.writerow(["t"] + [name for name, _ in CHANNELS] + ["event", "value"])
+    rows = 0
+    for t, x, event, value in decode(body):
+        w.writerow(["%.3f" % (t / 1000)] +
+                   (["" if v is None else v for v in x] if x
+                    else [""] * len(CHANNELS)) + [event, value])
+        rows += 1
+    print("%d bytes, %d records" % (len(body), rows), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
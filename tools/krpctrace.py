@@ -0,0 +1,226 @@
+#!/usr/bin/env python3
+"""Capture and replay the serial kRPC link between LDSKY and the game.
+
+Usage:
+  krpctrace.py capture --device /dev/ttyACM0 -o flight.trace
+  krpctrace.py replay flight.trace --device /dev/ttyACM0 [--scale 0.5]
+  krpctrace.py replay flight.trace --pty [--scale 0]
+  krpctrace.py stats flight.trace
+
+capture opens a pty and prints its path. Point the kRPC serial server at
+that path (or at the --link symlink). Every byte is forwarded between the
+server and the device and logged with a timestamp.
+
+replay plays the game side of a trace back to a device, with no game
+running. Each game message is sent after its original delay, multiplied
+by --scale (0 sends right away). The device's messages are compared with
+the trace. --pty serves a pty instead of a serial port, e.g. for an
+emulated board. The same verbs have to be keyed in as during the capture;
+--timeout bounds the wait for each device message.
+
+Trace format: one line per read, "<seconds> <D|G> <hex>". D is device to
+game, G is game to device.
+
+Both modes print latency and throughput per direction. replay exits
+non-zero if the device diverged from the trace, so it can be used as a
+regression test.
+"""
+
+import argparse
+import math
+import os
+import select
+import sys
+import time
+import tty
+
+BAUD = 115200  # KRPC_RATE in base.h; the port is KRPC_USART
+DEVICE, GAME = "D", "G"
+
+
+class Link:
+    """A serial port or the master side of a pty, read with a timeout."""
+
+    def __init__(self, device=None, baud=BAUD):
+        if device:
+            import serial  # pyserial
+
+            self.port = serial.Serial(device, baud, timeout=0)
+            self.fd = self.port.fileno()
+            self.name = device
+        else:
+            self.port = None
+            self.fd, slave = os.openpty()
+            tty.setraw(slave)
+            self.name = os.ttyname(slave)
+            self.slave = slave  # keep open s.t. reads don't fail with EIO
+
+    def read(self, timeout):
+        ready, _, _ = select.select([self.fd], [], [], timeout)
+        if not ready:
+            return b""
+        return os.read(self.fd, 4096)
+
+    def write(self, data):
+        while data:
+            data = data[os.write(self.fd, data):]
+
+
+def load(path):
+    records = []
+    with open(path) as f:
+        for n, line in enumerate(f, 1):
+            line = line.strip()
+            if not line or line.startswith("#"):
+                continue
+            t, d, data = line.split()
+            if d not in (DEVICE, GAME):
+                sys.exit("%s:%d: bad direction %r" % (path, n, d))
+            records.append((float(t), d, bytes.fromhex(data)))
+    return records
+
+
+def messages(records):
+    """Merge consecutive reads in the same direction into messages."""
+    out = []
+    for t, d, data in records:
+        if out and out[-1][1] == d:
+            out[-1] = (out[-1][0], d, out[-1][2] + data, t)
+        else:
+            out.append((t, d, data, t))
+    return out  # (first byte time, direction, bytes, last byte time)
+
+
+def summary(msgs, label):
+    """Print turnaround and throughput per direction."""
+    for d, name in ((DEVICE, "device"), (GAME, "game")):
+        # turnaround: end of the other side's message to our first byte
+        waits = [m[0] - p[3] for p, m in zip(msgs, msgs[1:]) if m[1] == d]
+        size = sum(len(m[2]) for m in msgs if m[1] == d)
+        if not waits:
+            continue
+        waits.sort()
+        mean = sum(waits) / len(waits)
+        p95 = waits[math.ceil(0.95 * len(waits)) - 1]
+        print("%s %-6s msgs %5d  bytes %7d  turnaround ms: "
+              "mean %7.2f  p95 %7.2f  max %7.2f"
+              % (label, name, len(waits), size, 1000 * mean, 1000 * p95,
+                 1000 * waits[-1]))
+    if len(msgs) > 1:
+        span = msgs[-1][3] - msgs[0][0]
+        total = sum(len(m[2]) for m in msgs)
+        print("%s total  %.3f s, %.0f bytes/s"
+              % (label, span, total / span if span else 0))
+
+
+def capture(args):
+    dev = Link(args.device, args.baud)
+    game = Link()
+    if args.link:
+        if os.path.lexists(args.link):
+            os.remove(args.link)
+        os.symlink(game.name, args.link)
+    print("kRPC server port: %s" % (args.link or game.name), file=sys.stderr)
+    records = []
+    t0 = time.monotonic()
+    try:
+        with open(args.output, "w") as log:
+            while True:
+                ready, _, _ = select.select([dev.fd, game.fd], [], [])
+                for src, dst, d in ((dev, game, DEVICE), (game, dev, GAME)):
+                    if src.fd not in ready:
+                        continue
+                    data = src.read(0)
+                    t = time.monotonic() - t0
+                    if not data:
+                        continue
+                    dst.write(data)
+                    log.write("%.6f %s %s\n" % (t, d, data.hex()))
+                    records.append((t, d, data))
+    except KeyboardInterrupt:
+        pass
+    finally:
+        if args.link and os.path.islink(args.link):
+            os.remove(args.link)
+    summary(messages(records), "capture")
+
+
+def replay(args):
+    msgs = messages(load(args.trace))
+    dev = Link(None if args.pty else args.device, args.baud)
+    if args.pty:
+        print("device port: %s" % dev.name, file=sys.stderr)
+    seen = []  # replayed messages, same layout as msgs
+    extra = b""  # device bytes read past the end of a message
+    mismatches = 0
+    t0 = time.monotonic()
+    last_end = 0.0  # end of the previous message, replay time
+    for i, (t, d, data, t_end) in enumerate(msgs):
+        if d == GAME:
+            gap = t - msgs[i - 1][3] if i else 0
+            delay = last_end + gap * args.scale - (time.monotonic() - t0)
+            if delay > 0:
+                time.sleep(delay)
+            start = time.monotonic() - t0
+            dev.write(data)
+            last_end = time.monotonic() - t0
+            seen.append((start, d, data, last_end))
+            continue
+        got, start = extra, (time.monotonic() - t0) if extra else None
+        deadline = time.monotonic() + args.timeout
+        while len(got) < len(data) and time.monotonic() < deadline:
+            chunk = dev.read(deadline - time.monotonic())
+            if chunk and start is None:
+                start = time.monotonic() - t0
+            got += chunk
+        if len(got) < len(data):
+            sys.exit("message %d: device sent %d of %d bytes"
+                     % (i, len(got), len(data)))
+        got, extra = got[:len(data)], got[len(data):]
+        last_end = time.monotonic() - t0
+        seen.append((start, d, got, last_end))
+        if got != data:
+            mismatches += 1
+            print("message %d differs:\n  trace  %s\n  device %s"
+                  % (i, data.hex(), got.hex()), file=sys.stderr)
+            if args.strict:
+                break
+    summary(msgs, "trace ")
+    summary(seen, "replay")
+    if mismatches:
+        sys.exit("%d of %d device messages differ"
+                 % (mismatches, sum(1 for m in msgs if m[1] == DEVICE)))
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("--baud", type=int, default=BAUD)
+    sub = ap.add_subparsers(dest="cmd", required=True)
+    p = sub.add_parser("capture", help="log a live session")
+    p.add_argument("--device", required=True, help="LDSKY serial port")
+    p.add_argument("-o", "--output", required=True, help="trace file")
+    p.add_argument("--link", help="symlink to the pty for the kRPC server")
+    p = sub.add_parser("replay", help="play the game side of a trace")
+    p.add_argument("trace")
+    src = p.add_mutually_exclusive_group(required=True)
+    src.add_argument("--device", help="LDSKY serial port")
+    src.add_argument("--pty", action="store_true", help="serve a pty")
+    p.add_argument("--scale", type=float, default=1.0,
+                   help="game response delay factor (0: no delay)")
+    p.add_argument("--timeout", type=float, default=30.0,
+                   help="seconds to wait for each device message")
+    p.add_argument("--strict", action="store_true",
+                   help="stop at the first mismatch")
+    p = sub.add_parser("stats", help="summarize a trace")
+    p.add_argument("trace")
+    args = ap.parse_args()
+    if args.cmd == "capture":
+        capture(args)
+    elif args.cmd == "replay":
+        replay(args)
+    else:
+        summary(messages(load(args.trace)), "trace")
+
+
+if __name__ == "__main__":
+    main()
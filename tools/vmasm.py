@@ -0,0 +1,169 @@
+#!/usr/bin/env python3
+"""Assembler and uploader for LDSKY script VM bytecode (see vm.hpp).
+
+Usage:
+  vmasm.py script.vm -o script.bin        assemble only
+  vmasm.py script.vm --port /dev/ttyACM0  assemble and upload
+
+Before uploading, start verb 38 with the target program as its noun, for
+example V38 N10 for EEPROM slot 0. Run the stored script with V37 N10.
+
+NOTE: a Mega resets when its USB serial port is opened with DTR set,
+which would stop verb 38 and send the upload to the bootloader. The
+uploader opens the port with DTR off, but some OS drivers raise it on
+open anyway (on Linux, "stty -F /dev/ttyACM0 -hupcl" once keeps it
+down). An upload that fails at byte 0 usually means the board reset.
+
+Syntax: one instruction per line, with operands separated by commas or
+spaces. ';' starts a comment and 'name:' defines a label. Registers are
+r0 to r7. Numbers are decimal, and LDI immediates may have up to 3
+decimals.
+
+  loop:   ldi r0, 1.5
+          waitgt alt, r1
+          ctl throttle, r0
+          krel 33, 1, abort
+"""
+
+import argparse
+import struct
+import sys
+
+# NOTE: keep in sync with VM::op_t; operand kinds:
+#       r register, c telemetry channel, k control, b u8, w u16, i imm, a addr
+OPS = [
+    ("halt", ""), ("ldi", "ri"), ("mov", "rr"), ("add", "rr"),
+    ("sub", "rr"), ("mul", "rr"), ("div", "rr"), ("tlm", "rc"),
+    ("waitlt", "cr"), ("waitgt", "cr"), ("sleep", "w"), ("jmp", "a"),
+    ("blt", "rra"), ("bge", "rra"), ("verb", "bb"), ("krel", "bba"),
+    ("ctl", "kr"), ("stage", ""),
+]
+CHANNELS = ["alt", "ralt", "vspd", "hspd", "speed", "gforce"]
+CONTROLS = ["throttle", "pitch", "yaw", "roll", "sas", "rcs", "gear"]
+SIZES = {"r": 1, "c": 1, "k": 1, "b": 1, "w": 2, "i": 4, "a": 2}
+NUM_REGS = 8
+CODE_LEN = 512 - 4
+CHUNK = 32
+
+
+def crc16(data, crc=0xFFFF):
+    # same as avr-libc _crc16_update()
+    for b in data:
+        crc ^= b
+        for _ in range(8):
+            crc = (crc >> 1) ^ 0xA001 if crc & 1 else crc >> 1
+    return crc
+
+
+def parse(text):
+    lines = []
+    for n, line in enumerate(text.splitlines(), 1):
+        line = line.split(";")[0].strip()
+        while ":" in line:  # labels, possibly followed by an instruction
+            label, line = line.split(":", 1)
+            lines.append((n, label.strip() + ":", []))
+            line = line.strip()
+        if line:
+            words = line.replace(",", " ").split()
+            lines.append((n, words[0].lower(), words[1:]))
+    return lines
+
+
+def assemble(text):
+    names = [op[0] for op in OPS]
+    lines = parse(text)
+    # pass 1: label addresses
+    labels, pc = {}, 0
+    for n, word, args in lines:
+        if word.endswith(":"):
+            labels[word[:-1]] = pc
+        elif word in names:
+            pc += 1 + sum(SIZES[k] for k in OPS[names.index(word)][1])
+        else:
+            raise SyntaxError("line %d: unknown instruction %r" % (n, word))
+    # pass 2: encode
+    code = bytearray()
+    for n, word, args in lines:
+        if word.endswith(":"):
+            continue
+        op = names.index(word)
+        kinds = OPS[op][1]
+        if len(args) != len(kinds):
+            raise SyntaxError("line %d: %s takes %d operands"
+                              % (n, word, len(kinds)))
+        code.append(op)
+        for kind, arg in zip(kinds, args):
+            try:
+                code += encode(kind, arg.lower(), labels)
+            except (ValueError, KeyError, struct.error):
+                raise SyntaxError("line %d: bad operand %r" % (n, arg))
+    if len(code) > CODE_LEN:
+        raise SyntaxError("script too long (%d > %d bytes)"
+                          % (len(code), CODE_LEN))
+    return bytes(code)
+
+
+def encode(kind, arg, labels):
+    if kind == "r":
+        if not arg.startswith("r") or not 0 <= int(arg[1:]) < NUM_REGS:
+            raise ValueError(arg)
+        return bytes([int(arg[1:])])
+    if kind == "c":
+        return bytes([CHANNELS.index(arg)])
+    if kind == "k":
+        return bytes([CONTROLS.index(arg)])
+    if kind == "b":
+        return struct.pack("<B", int(arg))
+    if kind == "w":
+        return struct.pack("<H", int(arg))
+    if kind == "i":
+        return struct.pack("<i", round(float(arg) * 1000))
+    if kind == "a":
+        return struct.pack("<H", labels[arg] if arg in labels else int(arg))
+    raise ValueError(kind)
+
+
+def upload(port, code):
+    import serial  # pyserial
+
+    s = serial.Serial()  # not opened yet, s.t. DTR can be set first
+    s.port = port
+    s.baudrate = 115200
+    s.timeout = 5
+    s.dtr = False  # DTR pulses reset the Mega
+    s.open()
+    with s:
+        s.write(b"SC" + struct.pack("<HH", len(code), crc16(code)))
+        for i in range(0, len(code), CHUNK):
+            s.write(code[i:i + CHUNK])
+            reply = s.read(1)
+            if reply != b"+":
+                sys.exit("upload failed at byte %d (%r)" % (i, reply))
+        reply = s.read(1)
+        if reply != b"=":
+            sys.exit("upload not confirmed (%r)" % reply)
+    print("stored %d bytes, crc %04x" % (len(code), crc16(code)))
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("source")
+    ap.add_argument("-o", "--output", help="write the bytecode to a file")
+    ap.add_argument("--port", help="serial port to upload to")
+    args = ap.parse_args()
+    with open(args.source) as f:
+        try:
+            code = assemble(f.read())
+        except SyntaxError as e:
+            sys.exit("%s: %s" % (args.source, e))
+    if args.output:
+        with open(args.output, "wb") as f:
+            f.write(code)
+    if args.port:
+        upload(args.port, code)
+    if not args.output and not args.port:
+        print(code.hex())
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,187 @@
+/*
+ * USART driver
+ * Interrupt-driven serial port with large rings and error accounting,
+ * for the kRPC link
+ * NOTE: the stock HardwareSerial keeps 64 bytes per direction; a kRPC
+ *       reply arriving while the main loop is busy overflows that
+ *       silently and the call then fails on garbage
+ * NOTE: stands in for a HardwareSerial, so kRPC takes it as its
+ *       connection; begin() and end() aren't virtual, so call them on
+ *       the Usart itself, not through the base
+ */
+
+#ifndef USART_H
+#define USART_H
+
+#include "base.h"
+#include <HardwareSerial.h>
+#include <HardwareSerial_private.h> // base constructor (declared inline)
+
+// register and vector names of USART n, e.g. USART_CAT(UCSR, 1, A)
+#define USART_CAT_(a, n, b) a##n##b
+#define USART_CAT(a, n, b) USART_CAT_(a, n, b)
+#define USART_REGS(n)                                                    \
+  &USART_CAT(UBRR, n, H), &USART_CAT(UBRR, n, L),                        \
+      &USART_CAT(UCSR, n, A), &USART_CAT(UCSR, n, B),                    \
+      &USART_CAT(UCSR, n, C), &USART_CAT(UDR, n, )
+#define USART_RX_VECT(n) USART_CAT(USART, n, _RX_vect)
+#define USART_UDRE_VECT(n) USART_CAT(USART, n, _UDRE_vect)
+
+class Usart : public HardwareSerial
+{
+private:
+  uint8_t rx_buf_[USART_RX_LEN];
+  uint8_t tx_buf_[USART_TX_LEN];
+  volatile uint16_t rx_head_, rx_tail_;
+  volatile uint8_t tx_head_, tx_tail_;
+  bool written_; // anything sent since begin(), for flush()
+
+  // NOTE: 16-bit indices shared with the ISR; read them with interrupts
+  //       off
+  uint16_t rx_count()
+  {
+    uint8_t sreg = SREG;
+    cli();
+    uint16_t n = (rx_head_ - rx_tail_) & (USART_RX_LEN - 1);
+    SREG = sreg;
+    return n;
+  }
+
+public:
+  // error counters, since begin()
+  volatile uint16_t frame_errors; // bad stop bit, e.g. baud mismatch
+  volatile uint16_t hw_overruns;  // overrun events, a byte or more lost
+  volatile uint16_t rx_overflows; // bytes lost to a full ring
+  volatile uint16_t rx_high;      // ring high-water mark, in bytes
+
+  Usart(volatile uint8_t *ubrrh, volatile uint8_t *ubrrl,
+        volatile uint8_t *ucsra, volatile uint8_t *ucsrb,
+        volatile uint8_t *ucsrc, volatile uint8_t *udr)
+      : HardwareSerial(ubrrh, ubrrl, ucsra, ucsrb, ucsrc, udr)
+  {
+  }
+
+  // open the port at baud, 8N1
+  // NOTE: double speed mode throughout; at 16 MHz 250000 and 500000 baud
+  //       are exact, 115200 is 2.1% off (fine on both ends' receivers)
+  void begin(unsigned long baud)
+  {
+    uint16_t ubrr = (F_CPU / 4 / baud - 1) / 2;
+    *_ucsrb = 0;
+    rx_head_ = rx_tail_ = 0;
+    tx_head_ = tx_tail_ = 0;
+    written_ = false;
+    frame_errors = hw_overruns = rx_overflows = rx_high = 0;
+    *_ucsra = _BV(U2X0);
+    *_ubrrh = ubrr >> 8;
+    *_ubrrl = ubrr;
+    *_ucsrc = _BV(UCSZ01) | _BV(UCSZ00);
+    *_ucsrb = _BV(RXEN0) | _BV(TXEN0) | _BV(RXCIE0);
+  }
+  void begin(unsigned long baud, uint8_t config)
+  {
+    (void)config; // 8N1 only
+    begin(baud);
+  }
+  void end()
+  {
+    flush();
+    *_ucsrb = 0;
+    rx_head_ = rx_tail_;
+  }
+
+  // NOTE: Stream interface, for the kRPC library
+  virtual int available() { return rx_count(); }
+  virtual int peek()
+  {
+    if (rx_count() == 0)
+      return -1;
+    return rx_buf_[rx_tail_];
+  }
+  virtual int read()
+  {
+    if (rx_count() == 0)
+      return -1;
+    uint8_t c = rx_buf_[rx_tail_];
+    uint8_t sreg = SREG;
+    cli();
+    rx_tail_ = (rx_tail_ + 1) & (USART_RX_LEN - 1);
+    SREG = sreg;
+    return c;
+  }
+  virtual int availableForWrite()
+  {
+    return (tx_tail_ - tx_head_ - 1) & (USART_TX_LEN - 1);
+  }
+  virtual void flush()
+  {
+    if (!written_)
+      return;
+    while ((*_ucsrb & _BV(UDRIE0)) || !(*_ucsra & _BV(TXC0)))
+      if (!(SREG & _BV(SREG_I)) && (*_ucsrb & _BV(UDRIE0)) &&
+          (*_ucsra & _BV(UDRE0)))
+        udre_isr(); // interrupts off; send by polling
+  }
+  virtual size_t write(uint8_t c)
+  {
+    written_ = true;
+    // ring empty and data register free: skip the ring
+    if (tx_head_ == tx_tail_ && (*_ucsra & _BV(UDRE0)))
+    {
+      uint8_t sreg = SREG;
+      cli();
+      *_udr = c;
+      *_ucsra = (*_ucsra & _BV(U2X0)) | _BV(TXC0); // clear TXC
+      SREG = sreg;
+      return 1;
+    }
+    uint8_t next = (tx_head_ + 1) & (USART_TX_LEN - 1);
+    while (next == tx_tail_) // ring full; wait for the ISR to drain it
+      if (!(SREG & _BV(SREG_I)) && (*_ucsra & _BV(UDRE0)))
+        udre_isr(); // interrupts off; send by polling
+    tx_buf_[tx_head_] = c;
+    uint8_t sreg = SREG;
+    cli();
+    tx_head_ = next;
+    *_ucsrb |= _BV(UDRIE0);
+    SREG = sreg;
+    return 1;
+  }
+  using Print::write;
+
+  // receive one byte; call from ISR(USARTn_RX_vect)
+  void rx_isr()
+  {
+    uint8_t status = *_ucsra;
+    uint8_t c = *_udr;
+    if (status & _BV(FE0))
+    {
+      frame_errors += 1;
+      return;
+    }
+    if (status & _BV(DOR0)) // this byte made it, the ones before didn't
+      hw_overruns += 1;
+    uint16_t next = (rx_head_ + 1) & (USART_RX_LEN - 1);
+    if (next == rx_tail_)
+    {
+      rx_overflows += 1;
+      return;
+    }
+    rx_buf_[rx_head_] = c;
+    rx_head_ = next;
+    uint16_t n = (next - rx_tail_) & (USART_RX_LEN - 1);
+    if (n > rx_high)
+      rx_high = n;
+  }
+  // send one byte; call from ISR(USARTn_UDRE_vect)
+  void udre_isr()
+  {
+    *_udr = tx_buf_[tx_tail_];
+    *_ucsra = (*_ucsra & _BV(U2X0)) | _BV(TXC0); // clear TXC
+    tx_tail_ = (tx_tail_ + 1) & (USART_TX_LEN - 1);
+    if (tx_head_ == tx_tail_)
+      *_ucsrb &= ~_BV(UDRIE0);
+  }
+};
+
+#endif // USART_H
@@ -8,8 +8,11 @@
 
 #include "system.hpp"
 #include "comm.hpp"
+#include "control.hpp"
 #include "devices.hpp"
 #include "sysutils.hpp"
+#include "telemetry.hpp"
+#include "vm.hpp"
 
 namespace Verbs
 {
@@ -18,6 +21,112 @@ namespace Verbs
 // NOTE: remember to add implementations to the init list!
 // NOTE: verb return values: use SysUtils::SysManager::verb_status_t
 
+// 06: display system statistics (decimal)
+// noun 01: main loop duty cycle (%), loop passes/s, idle sleeps/s
+// noun 02: effective screen update rate, active rate, idle rate (Hz)
+// noun 03: warm boot (1) or cold boot (0), boot time (us), reset cause
+// noun 04: kRPC link state, handshake attempts, time to connect (ms)
+// noun 05: script VM steps, longest step (us), last faulting address
+// noun 06: kRPC transactions, mean and longest transaction time (us)
+// noun 07: kRPC receive ring high-water mark and bytes dropped with the
+//          ring full, USART overrun events (each lost at least a byte)
+// noun 08: supervisor overruns, last verb and program that overran
+// noun 09: control loop rate (Hz), mean and largest period jitter (us)
+// noun 10: timer wheel callbacks, overruns in total and of the screen
+//          update
+// noun 11: kRPC framing errors, transactions unwound by the supervisor,
+//          dirty link recoveries (drained and re-handshaken)
+// noun 50+op: script VM instruction count, total time (us), mean (ns)
+int verb_06(int *p_stage, void **pp_data)
+{
+  if (*p_stage == 0)
+  {
+    Devices::lcd->clearDataRows();
+    *p_stage = 1;
+  }
+  switch (SysUtils::sys->get_noun())
+  {
+  case 1:
+    Devices::lcd->setScaled(1, System::duty_pm, 1);
+    Devices::lcd->setInt(2, System::loop_rate);
+    Devices::lcd->setInt(3, System::sleep_rate);
+    break;
+  case 2:
+    Devices::lcd->setInt(1, System::disp_freq);
+    Devices::lcd->setInt(2, System::conf->disp_freq_hi);
+    Devices::lcd->setInt(3, System::conf->disp_freq_lo);
+    break;
+  case 3:
+    Devices::lcd->setInt(1, System::warm_boot);
+    Devices::lcd->setInt(2, System::boot_us);
+    Devices::lcd->setUL(3, System::reset_cause, true);
+    break;
+  case 4:
+    Devices::lcd->setInt(1, Comm::conn_state);
+    Devices::lcd->setInt(2, Comm::connect_attempts);
+    Devices::lcd->setInt(3, Comm::connect_ms);
+    break;
+  case 5:
+    Devices::lcd->setInt(1, VM::steps);
+    Devices::lcd->setInt(2, VM::step_us_max);
+    Devices::lcd->setInt(3, VM::fault_pc);
+    break;
+  case 6:
+  {
+    unsigned long n = Comm::xact_count;
+    Devices::lcd->setInt(1, n);
+    Devices::lcd->setInt(2, n ? Comm::xact_us_total / n : 0);
+    Devices::lcd->setInt(3, Comm::xact_us_max);
+    break;
+  }
+  case 7:
+    Devices::lcd->setInt(1, Comm::link.rx_high);
+    Devices::lcd->setInt(2, Comm::link.rx_overflows);
+    Devices::lcd->setInt(3, Comm::link.hw_overruns);
+    break;
+  case 8:
+    Devices::lcd->setInt(1, System::sup_overruns);
+    Devices::lcd->setInt(2, System::sup_verb);
+    Devices::lcd->setInt(3, System::sup_pgm);
+    break;
+  case 9:
+  {
+    unsigned long n = Control::intervals;
+    Devices::lcd->setScaled(1, Control::rate_x10(), 1);
+    Devices::lcd->setInt(2, n ? Control::jitter_us_total / n : 0);
+    Devices::lcd->setInt(3, Control::jitter_us_max);
+    break;
+  }
+  case 10:
+  {
+    long n = 0;
+    for (uint8_t t = 0; t < Wheel::num_timers; t++)
+      n += Wheel::timers[t].overruns;
+    Devices::lcd->setInt(1, Wheel::num_timers);
+    Devices::lcd->setInt(2, n);
+    Devices::lcd->setInt(3, Wheel::timers[System::disp_timer].overruns);
+    break;
+  }
+  case 11:
+    Devices::lcd->setInt(1, Comm::link.frame_errors);
+    Devices::lcd->setInt(2, Comm::xact_unwinds);
+    Devices::lcd->setInt(3, (long)Comm::resyncs + Comm::reconnects);
+    break;
+  default:
+  {
+    int op = SysUtils::sys->get_noun() - 50;
+    if (op < 0 || op >= VM::NUM_OPS)
+      return SysUtils::SysManager::V_OPR_ERR;
+    unsigned long n = VM::op_count[op];
+    Devices::lcd->setInt(1, n);
+    Devices::lcd->setInt(2, VM::op_us[op]);
+    Devices::lcd->setInt(3, n ? VM::op_us[op] * 1000 / n : 0);
+  }
+  }
+  SysUtils::sys->sleep_verb(500);
+  return SysUtils::SysManager::V_RUN;
+}
+
 // 16: display time elapsed since LDSKY bootup (h:m:s)
 int verb_16(int *p_stage, void **pp_data)
 {
@@ -30,10 +139,99 @@ int verb_16(int *p_stage, void **pp_data)
   Devices::lcd->setInt(1, s / 3600);
   Devices::lcd->setInt(2, (s / 60) % 60);
   Devices::lcd->setInt(3, s % 60);
-  delay(50); // don't work too hard for a clock...
+  SysUtils::sys->sleep_verb(200); // don't work too hard for a clock...
   return SysUtils::SysManager::V_RUN;
 }
 
+// 21: load a word of the system config (System::conf) in SRAM
+// noun 01:hex; 02:dec
+// NOTE: address on row 1, value on row 2; cursor keys switch rows
+// NOTE: addresses outside the config are refused (OPR ERR); the change
+//       lasts until reset
+struct verb_21_data
+{
+  unsigned long addr;
+  unsigned long value;
+};
+int verb_21(int *p_stage, void **pp_data)
+{
+  if (*p_stage == 0)
+  {
+    SysUtils::InputWindow::iw_mode mode;
+    if (SysUtils::sys->get_noun() == 1)
+      mode = SysUtils::InputWindow::IW_HEX;
+    else if (SysUtils::sys->get_noun() == 2)
+      mode = SysUtils::InputWindow::IW_UL;
+    else
+      return SysUtils::SysManager::V_OPR_ERR;
+    *pp_data = calloc(1, sizeof(verb_21_data));
+    verb_21_data *d = (verb_21_data *)*pp_data;
+    // init input window with two fields
+    SysUtils::sys->input_window_open(&(d->addr), 1, 0, LC_ROW_LEN, mode,
+                                     true);
+    SysUtils::sys->input_window_add(&(d->value), 2, 0, LC_ROW_LEN, mode);
+    *p_stage = 1;
+    return SysUtils::SysManager::V_RUN;
+  }
+  if (*p_stage == 1)
+  {
+    if (SysUtils::sys->iw_->status_ == SysUtils::InputWindow::IW_COMPLETE)
+    {
+      verb_21_data *d = (verb_21_data *)*pp_data;
+      unsigned long lo = (unsigned long)System::conf;
+      SysUtils::sys->input_window_close();
+      if (d->addr < lo || d->addr + sizeof(uint32_t) > lo + sizeof(CT_Config))
+        return SysUtils::SysManager::V_OPR_ERR;
+      memcpy((void *)d->addr, &d->value, sizeof(uint32_t));
+      return SysUtils::SysManager::V_COMPLETE;
+    }
+    else if (SysUtils::sys->iw_->status_ == SysUtils::InputWindow::IW_EXIT)
+    {
+      SysUtils::sys->input_window_close();
+      return SysUtils::SysManager::V_COMPLETE; // user exit, stop verb
+    }
+    else
+      return SysUtils::SysManager::V_RUN; // wait
+  }
+  return SysUtils::SysManager::V_COMPLETE;
+}
+
+// 23: set the display rows on MAX7219 chain NN and save the config
+// NOTE: row 2 shows the current count; key the new one in on row 1
+//       (0 to LC_CHAIN_LEN); takes effect at the next boot
+int verb_23(int *p_stage, void **pp_data)
+{
+  int chain = SysUtils::sys->get_noun();
+  if (chain >= LC_MAX_CHAINS)
+    return SysUtils::SysManager::V_OPR_ERR;
+  if (*p_stage == 0)
+  {
+    *pp_data = calloc(1, sizeof(unsigned long));
+    Devices::lcd->clearDataRows();
+    Devices::lcd->setInt(2, System::conf->lc_rows[chain]);
+    SysUtils::sys->input_window_open(*pp_data, 1, 0, LC_ROW_LEN,
+                                     SysUtils::InputWindow::IW_UL, false);
+    *p_stage = 1;
+    return SysUtils::SysManager::V_RUN;
+  }
+  if (SysUtils::sys->iw_->status_ == SysUtils::InputWindow::IW_COMPLETE)
+  {
+    unsigned long n = *(unsigned long *)*pp_data;
+    SysUtils::sys->input_window_close();
+    if (n > LC_CHAIN_LEN)
+      return SysUtils::SysManager::V_OPR_ERR;
+    System::conf->lc_rows[chain] = n;
+    return 0 == System::write_config() ? SysUtils::SysManager::V_COMPLETE
+                                       : SysUtils::SysManager::V_PGM_ERR;
+  }
+  else if (SysUtils::sys->iw_->status_ == SysUtils::InputWindow::IW_EXIT)
+  {
+    SysUtils::sys->input_window_close();
+    return SysUtils::SysManager::V_COMPLETE; // user exit, stop verb
+  }
+  return SysUtils::SysManager::V_RUN; // wait
+}
+
 // 27: display memory location
 // verb 01:hex; 02:dec
 struct verb_27_data
@@ -56,24 +254,23 @@ int verb_27(int *p_stage, void **pp_data)
       return SysUtils::SysManager::V_OPR_ERR;
     // init input window
     SysUtils::sys->input_window_open(&(d->addr), 1, 0, LC_ROW_LEN,
-                                     SysUtils::InputWindow::IW_UL, false);
+                                     d->hex ? SysUtils::InputWindow::IW_HEX
+                                            : SysUtils::InputWindow::IW_UL,
+                                     false);
     *p_stage = 1;
     return SysUtils::SysManager::V_RUN;
   }
   if (*p_stage == 1)
   {
-    Devices::lcd->setUpdateAll(false);
     if (SysUtils::sys->iw_->status_ == SysUtils::InputWindow::IW_COMPLETE)
     {
       SysUtils::sys->input_window_close();
-      Devices::lcd->setUpdateAll(true);
       *p_stage = 2;
       return SysUtils::SysManager::V_RUN; // go to next stage
     }
     else if (SysUtils::sys->iw_->status_ == SysUtils::InputWindow::IW_EXIT)
     {
       SysUtils::sys->input_window_close();
-      Devices::lcd->setUpdateAll(true);
       return SysUtils::SysManager::V_COMPLETE; // user exit, stop verb
     }
     else
@@ -91,23 +288,117 @@ int verb_27(int *p_stage, void **pp_data)
   return SysUtils::SysManager::V_COMPLETE; // how'd we get here?
 }
 
-// 32: empty test verb for now
+// 32: fast path vs reference benchmark, in microseconds per 100 ops
+// noun 01: Q16.16 multiply + divide, double multiply + divide, ratio (%)
+// noun 02: Q16.16 sin/cos + atan2, double sin + cos + atan2, ratio (%)
+// noun 03: FastPin set + clear, digitalWrite HIGH + LOW, ratio (%)
+// NOTE: runs once with interrupts enabled, so expect some ISR noise
 int verb_32(int *p_stage, void **pp_data)
 {
+  using namespace Fixed;
+  const int n = 100;
+  volatile q16_t qa = q16_from_double(1.2345), qb = q16_from_double(0.678);
+  volatile double da = 1.2345, db = 0.678;
+  volatile q16_t qr;
+  volatile double dr;
+  unsigned long t0, t_fast, t_ref;
+  switch (SysUtils::sys->get_noun())
+  {
+  case 1:
+    t0 = micros();
+    for (int i = 0; i < n; i++)
+      qr = q16_div(q16_mul(qa, qb), qb);
+    t_fast = micros() - t0;
+    t0 = micros();
+    for (int i = 0; i < n; i++)
+      dr = da * db / db;
+    t_ref = micros() - t0;
+    break;
+  case 2:
+    t0 = micros();
+    for (int i = 0; i < n; i++)
+    {
+      q16_t s, c;
+      q16_sincos(qa, &s, &c);
+      qr = q16_atan2(s, c);
+    }
+    t_fast = micros() - t0;
+    t0 = micros();
+    for (int i = 0; i < n; i++)
+      dr = atan2(sin(da), cos(da));
+    t_ref = micros() - t0;
+    break;
+  case 3: // NOTE: toggles the activity LED
+    t0 = micros();
+    for (int i = 0; i < n; i++)
+    {
+      FastIO::FastPin<LED_ACT>::set();
+      FastIO::FastPin<LED_ACT>::clear();
+    }
+    t_fast = micros() - t0;
+    t0 = micros();
+    for (int i = 0; i < n; i++)
+    {
+      digitalWrite(LED_ACT, HIGH);
+      digitalWrite(LED_ACT, LOW);
+    }
+    t_ref = micros() - t0;
+    break;
+  default:
+    return SysUtils::SysManager::V_OPR_ERR;
+  }
+  (void)qr;
+  (void)dr;
+  Devices::lcd->clearDataRows();
+  Devices::lcd->setInt(1, t_fast);
+  Devices::lcd->setInt(2, t_ref);
+  Devices::lcd->setInt(3, t_ref ? t_fast * 100 / t_ref : 0);
   return SysUtils::SysManager::V_COMPLETE;
 }
 
+// 33: monitor flight telemetry, extrapolated between kRPC samples
+// noun 01: altitude (m), vertical speed (m/s), horizontal speed (m/s)
+// noun 02: surface altitude (m), surface speed (m/s), g-force (g)
+// NOTE: a row flashes when its channel has gone stale
+int verb_33(int *p_stage, void **pp_data)
+{
+  using namespace Telemetry;
+  if (*p_stage == 0)
+  {
+    Devices::lcd->clearDataRows();
+    *p_stage = 1;
+  }
+  switch (SysUtils::sys->get_noun())
+  {
+  case 1:
+    show(1, CH_ALT, 0);
+    show(2, CH_VSPD, 1);
+    show(3, CH_HSPD, 1);
+    break;
+  case 2:
+    show(1, CH_RALT, 0);
+    show(2, CH_SPEED, 1);
+    show(3, CH_GFORCE, 2);
+    break;
+  default:
+    return SysUtils::SysManager::V_OPR_ERR;
+  }
+  SysUtils::sys->sleep_verb(50);
+  return SysUtils::SysManager::V_RUN;
+}
+
 // 36: update information from kRPC
+// shows the refresh time (us), kRPC transactions and failed transactions
+// NOTE: looks up the active vessel again, e.g. after a vessel switch
 int verb_36(int *p_stage, void **pp_data)
 {
-  using namespace Comm;
-  krpc_SpaceCenter_ActiveVessel(conn, vessel);
-  krpc_SpaceCenter_Vessel_Control(conn, control, vessel);
-  // TODO
-
-  // TODO: update all displays
-
-  return SysUtils::SysManager::V_COMPLETE;
+  int err = Comm::refresh();
+  Devices::lcd->clearDataRows();
+  Devices::lcd->setInt(1, Comm::xact_us_last);
+  Devices::lcd->setInt(2, Comm::xact_count);
+  Devices::lcd->setInt(3, Comm::xact_errors);
+  return err ? SysUtils::SysManager::V_PGM_ERR
+             : SysUtils::SysManager::V_COMPLETE;
 }
 
 // 37: set up the selected program for launch in the next ISR
@@ -120,18 +411,180 @@ int verb_37(int *p_stage, void **pp_data)
     return SysUtils::SysManager::V_OPR_ERR;
 }
 
+// 38: upload a script over serial into the EEPROM slot of program NN
+// NOTE: the console keeps off Serial while this runs; see
+//       VM::upload_step()
+// NOTE: rows show bytes received, script length and, once stored, the CRC
+int verb_38(int *p_stage, void **pp_data)
+{
+  int slot = SysUtils::sys->get_noun() - VM_PGM_EE;
+  if (slot < 0 || slot >= VM_SCRIPT_SLOTS ||
+      Comm::conn_state != Comm::CONN_OFF)
+    return SysUtils::SysManager::V_OPR_ERR;
+  if (*p_stage == 0)
+  {
+    *pp_data = calloc(1, sizeof(VM::Upload));
+    Devices::lcd->clearDataRows();
+    *p_stage = 1;
+  }
+  VM::Upload *u = (VM::Upload *)*pp_data;
+  int ret = VM::upload_step(u, slot);
+  Devices::lcd->setInt(1, u->pos);
+  Devices::lcd->setInt(2, u->len);
+  if (ret < 0)
+    return SysUtils::SysManager::V_OPR_ERR;
+  if (ret == 0)
+  {
+    Devices::lcd->setUL(3, u->crc, true);
+    return SysUtils::SysManager::V_COMPLETE;
+  }
+  return SysUtils::SysManager::V_RUN;
+}
+
+// 46: closed-loop holds (see control.hpp)
+// noun 00: release all holds; 01: vertical speed hold (m/s);
+//      02: altitude hold (m)
+// NOTE: key in the setpoint on row 1; the hold runs in the background
+//       until released or replaced, and takes over from the current
+//       throttle
+// NOTE: vertical speed and altitude are the only holds
+int verb_46(int *p_stage, void **pp_data)
+{
+  int noun = SysUtils::sys->get_noun();
+  if (*p_stage == 0)
+  {
+    SysUtils::InputWindow::iw_mode mode;
+    if (noun == 0)
+    {
+      Control::release();
+      return SysUtils::SysManager::V_COMPLETE;
+    }
+    else if (noun == 1)
+      mode = SysUtils::InputWindow::IW_Q16;
+    else if (noun == 2)
+      mode = SysUtils::InputWindow::IW_LONG;
+    else
+      return SysUtils::SysManager::V_OPR_ERR;
+    *pp_data = calloc(1, sizeof(long)); // holds a q16_t or a long
+    SysUtils::sys->input_window_open(*pp_data, 1, 0, LC_ROW_LEN, mode,
+                                     false);
+    *p_stage = 1;
+    return SysUtils::SysManager::V_RUN;
+  }
+  if (SysUtils::sys->iw_->status_ == SysUtils::InputWindow::IW_COMPLETE)
+  {
+    SysUtils::sys->input_window_close();
+    int err = noun == 1 ? Control::hold_vspd(*(Fixed::q16_t *)*pp_data)
+                        : Control::hold_alt(*(long *)*pp_data);
+    return err ? SysUtils::SysManager::V_PGM_ERR
+               : SysUtils::SysManager::V_COMPLETE;
+  }
+  else if (SysUtils::sys->iw_->status_ == SysUtils::InputWindow::IW_EXIT)
+  {
+    SysUtils::sys->input_window_close();
+    return SysUtils::SysManager::V_COMPLETE; // user exit, stop verb
+  }
+  return SysUtils::SysManager::V_RUN; // wait
+}
+
 // 69: hard-reset system
+// NOTE: programs resume from the warm restart snapshot after the reset
 int verb_69(int *p_stage, void **pp_data)
 {
+  SysUtils::sys->stop_verb(); // don't restart this verb after the reset
+  SysUtils::sys->checkpoint();
   System::reset_system();
   return SysUtils::SysManager::V_COMPLETE;
 }
 
+// 74: dump the flight data recorder over serial
+// NOTE: the recorder stops recording until the dump is out; decode the
+//       dump with tools/fdr_decode.py
+// NOTE: rows show bytes left, dump length and records dropped meanwhile
+int verb_74(int *p_stage, void **pp_data)
+{
+  if (*p_stage == 0)
+  {
+    Devices::lcd->clearDataRows();
+    Recorder::dump_begin();
+    Devices::lcd->setInt(2, Recorder::dump_left);
+    *p_stage = 1;
+  }
+  uint16_t left = Recorder::dump_step();
+  Devices::lcd->setInt(1, left);
+  Devices::lcd->setInt(3, Recorder::dropped);
+  if (left == 0)
+    return SysUtils::SysManager::V_COMPLETE;
+  SysUtils::sys->sleep_verb(10); // about a TX buffer at 115200 baud
+  return SysUtils::SysManager::V_RUN;
+}
+
+// 82: display orbit parameters, propagated locally between kRPC samples
+// noun 01: apoapsis altitude (km), periapsis altitude (km), time to Ap (s)
+// noun 02: altitude (km), time to periapsis (s), orbital period (s)
+// NOTE: values that don't exist on an escape trajectory are left blank
+struct verb_82_data
+{
+  Orbit::Elements el;
+  unsigned long next_sample; // time of the next state vector sample
+};
+void verb_82_show(int addr, double val, bool km)
+{
+  if (isnan(val))
+    Devices::lcd->clear(addr);
+  else if (km)
+    Devices::lcd->setScaled(addr, lround(val / 100), 1);
+  else
+    Devices::lcd->setInt(addr, lround(val));
+}
+int verb_82(int *p_stage, void **pp_data)
+{
+  int noun = SysUtils::sys->get_noun();
+  if (noun != 1 && noun != 2)
+    return SysUtils::SysManager::V_OPR_ERR;
+  if (*p_stage == 0)
+  {
+    *pp_data = calloc(1, sizeof(verb_82_data));
+    ((verb_82_data *)*pp_data)->next_sample = millis();
+    Devices::lcd->clearDataRows();
+    *p_stage = 1;
+  }
+  verb_82_data *d = (verb_82_data *)*pp_data;
+  unsigned long t = millis();
+  if ((long)(t - d->next_sample) >= 0)
+  {
+    Orbit::State s;
+    if (0 == Comm::sample_state(&s) && 0 == Orbit::from_state(s, t, &d->el))
+      d->next_sample = t + ORBIT_SAMPLE_MS;
+    else
+      d->next_sample = t + KRPC_RETRY_DELAY; // keep the old elements
+  }
+  if (d->el.valid)
+  {
+    Orbit::Derived o;
+    Orbit::propagate(d->el, t, &o);
+    if (noun == 1)
+    {
+      verb_82_show(1, o.ap_alt, true);
+      verb_82_show(2, o.pe_alt, true);
+      verb_82_show(3, o.t_ap, false);
+    }
+    else
+    {
+      verb_82_show(1, o.alt, true);
+      verb_82_show(2, o.t_pe, false);
+      verb_82_show(3, o.period, false);
+    }
+  }
+  SysUtils::sys->sleep_verb(100);
+  return SysUtils::SysManager::V_RUN;
+}
+
 // stage the current vessel
 int verb_99(int *p_stage, void **pp_data)
 {
-  using namespace Comm;
-  krpc_SpaceCenter_Control_ActivateNextStage(conn, vessel, control);
+  if (0 != Comm::stage())
+    return SysUtils::SysManager::V_PGM_ERR;
   return SysUtils::SysManager::V_COMPLETE;
 }
 
@@ -139,12 +592,20 @@ int verb_99(int *p_stage, void **pp_data)
 void init_verbs()
 {
   SysUtils::sys->register_verb(0, NULL, false);
+  SysUtils::sys->register_verb(6, &verb_06, true);
   SysUtils::sys->register_verb(16, &verb_16, false);
+  SysUtils::sys->register_verb(21, &verb_21, true);
+  SysUtils::sys->register_verb(23, &verb_23, true);
   SysUtils::sys->register_verb(27, &verb_27, true);
-  SysUtils::sys->register_verb(32, &verb_32, false);
+  SysUtils::sys->register_verb(32, &verb_32, true);
+  SysUtils::sys->register_verb(33, &verb_33, true);
   SysUtils::sys->register_verb(36, &verb_36, false);
   SysUtils::sys->register_verb(37, &verb_37, true);
+  SysUtils::sys->register_verb(38, &verb_38, true);
+  SysUtils::sys->register_verb(46, &verb_46, true);
   SysUtils::sys->register_verb(69, &verb_69, false);
+  SysUtils::sys->register_verb(74, &verb_74, false);
+  SysUtils::sys->register_verb(82, &verb_82, true);
   SysUtils::sys->register_verb(99, &verb_99, false);
 }
 
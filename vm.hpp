@@ -0,0 +1,465 @@
+/*
+ * Script VM
+ * Register-based bytecode interpreter for flight sequences, run as a
+ * program; scripts live in EEPROM slots (uploaded over serial, see verb 38)
+ * or in PROGMEM, so sequences can change without reflashing
+ */
+
+#ifndef VM_H
+#define VM_H
+
+#include "base.h"
+#include "storage.hpp"
+#include "comm.hpp"
+#include "telemetry.hpp"
+#include "sysutils.hpp"
+
+namespace VM
+{
+
+/* ===== instruction set ===== */
+// NOTE: one opcode byte, then operands; r: register index (1 byte),
+//       ch: telemetry channel, c: Comm::control_t, u8/u16: unsigned
+//       (little endian), i32: signed, in thousandths (1500 loads 1.5),
+//       a: absolute byte address in the script
+// NOTE: keep in sync with tools/vmasm.py
+
+enum op_t
+{
+  OP_HALT,   //                    end of script
+  OP_LDI,    // r i32              r = i32 / 1000
+  OP_MOV,    // r r2               r = r2
+  OP_ADD,    // r r2               r += r2
+  OP_SUB,    // r r2               r -= r2
+  OP_MUL,    // r r2               r *= r2
+  OP_DIV,    // r r2               r /= r2
+  OP_TLM,    // r ch               r = telemetry estimate
+  OP_WAITLT, // ch r               wait until channel < r (and fresh)
+  OP_WAITGT, // ch r               wait until channel > r (and fresh)
+  OP_SLEEP,  // u16                sleep for u16 milliseconds
+  OP_JMP,    // a                  jump
+  OP_BLT,    // r r2 a             jump if r < r2
+  OP_BGE,    // r r2 a             jump if r >= r2
+  OP_VERB,   // u8 u8              run verb/noun right away
+  OP_KREL,   // u8 u8 a            request key release for verb/noun;
+             //                    jump if the operator rejects it
+  OP_CTL,    // c r                set a control input
+  OP_STAGE,  //                    activate the next stage
+  NUM_OPS
+};
+
+/* ===== script sources ===== */
+
+// EEPROM slot: u16 length, u16 CRC16 of the code, then the code
+const uint16_t EE_BASE = CONFIG_ADDRESS + CONFIG_JOURNAL_LEN;
+const int HEADER_LEN = 4;
+const int CODE_LEN = VM_SCRIPT_LEN - HEADER_LEN;
+
+uint16_t slot_addr(int slot)
+{
+  return EE_BASE + slot * VM_SCRIPT_LEN;
+}
+
+// built-in script: hold the launch clamps until the operator releases
+// the key, then hop to 2 km on SAS and cut the throttle
+#define VM_I32(v) (uint8_t)((long)(v)), (uint8_t)((long)(v) >> 8), \
+                  (uint8_t)((long)(v) >> 16), (uint8_t)((long)(v) >> 24)
+#define VM_U16(v) (uint8_t)(v), (uint8_t)((v) >> 8)
+const uint8_t rom_script[] PROGMEM = {
+    /*  0 */ OP_KREL, 33, 1, VM_U16(40),    // show telemetry; B aborts
+    /*  5 */ OP_LDI, 0, VM_I32(1000),       // r0 = 1
+    /* 11 */ OP_CTL, Comm::CTL_SAS, 0,      // SAS on
+    /* 14 */ OP_CTL, Comm::CTL_THROTTLE, 0, // full throttle
+    /* 17 */ OP_STAGE,                      // ignition
+    /* 18 */ OP_LDI, 1, VM_I32(2000000),    // r1 = 2000
+    /* 24 */ OP_WAITGT, Telemetry::CH_ALT, 1,
+    /* 27 */ OP_LDI, 0, VM_I32(0),          // r0 = 0
+    /* 33 */ OP_CTL, Comm::CTL_THROTTLE, 0, // cut the throttle
+    /* 36 */ OP_SLEEP, VM_U16(1000),
+    /* 39 */ OP_HALT,
+    /* 40 */ OP_HALT};
+
+/* ===== interpreter ===== */
+
+// per-program VM state, kept in the program's data block
+// NOTE: small enough for the warm restart snapshot (WARM_DATA_LEN)
+struct VM_State
+{
+  uint16_t pc;          // next instruction
+  uint16_t len;         // code length
+  bool krel;            // waiting on a key release request
+  float r[VM_NUM_REGS]; // registers
+};
+
+// per-opcode cost statistics
+unsigned long op_count[NUM_OPS];
+unsigned long op_us[NUM_OPS];  // VM_PROFILE: time spent, in microseconds
+unsigned long steps = 0;       // program steps run
+unsigned long step_us_max = 0; // longest step, in microseconds
+int fault_pc = -1;             // address of the last faulting instruction
+
+// code fetch context for the running step
+struct Code
+{
+  bool rom;      // PROGMEM (built-in) or EEPROM
+  uint16_t addr; // EEPROM address of the code
+  uint16_t len;
+  uint16_t pc;
+  bool err; // read past the end of the script
+};
+
+uint8_t fetch(Code *c)
+{
+  if (c->pc >= c->len)
+  {
+    c->err = true;
+    return OP_HALT;
+  }
+  uint16_t i = c->pc++;
+  if (c->rom)
+    return pgm_read_byte(rom_script + i);
+  return Storage::ee_read(c->addr + i);
+}
+uint16_t fetch16(Code *c)
+{
+  uint16_t v = fetch(c);
+  return v | (uint16_t)fetch(c) << 8;
+}
+float fetch_imm(Code *c)
+{
+  uint32_t v = 0;
+  for (int i = 0; i < 4; i++)
+    v |= (uint32_t)fetch(c) << (8 * i);
+  return (int32_t)v / 1000.0;
+}
+
+// find the script of a program id; returns 0 on success, -1 if invalid
+// NOTE: the CRC check reads the whole slot, so only verify on start
+int open_code(int pgm, Code *c, bool verify)
+{
+  c->pc = 0;
+  c->err = false;
+  if (pgm == VM_PGM_ROM)
+  {
+    c->rom = true;
+    c->addr = 0;
+    c->len = sizeof(rom_script);
+    return 0;
+  }
+  int slot = pgm - VM_PGM_EE;
+  if (slot < 0 || slot >= VM_SCRIPT_SLOTS)
+    return -1;
+  c->rom = false;
+  c->addr = slot_addr(slot) + HEADER_LEN;
+  uint16_t hdr[2];
+  for (int i = 0; i < HEADER_LEN; i++)
+    ((uint8_t *)hdr)[i] = Storage::ee_read(slot_addr(slot) + i);
+  if (hdr[0] == 0 || hdr[0] > CODE_LEN)
+    return -1; // empty (erased) slot
+  c->len = hdr[0];
+  if (!verify)
+    return 0;
+  uint16_t crc = 0xFFFF;
+  for (uint16_t i = 0; i < c->len; i++)
+    crc = _crc16_update(crc, Storage::ee_read(c->addr + i));
+  return crc == hdr[1] ? 0 : -1;
+}
+
+// run the script of the current program for at most VM_STEP_OPS
+// instructions; waiting instructions and kRPC calls end the step early
+// NOTE: waits sleep on the event bus instead of polling
+// NOTE: dispatch uses computed goto (GCC labels as values)
+int run(int *p_stage, void **data_ptr)
+{
+  Code c;
+  if (0 != open_code(SysUtils::sys->get_program(), &c, *p_stage == 0))
+    return SysUtils::SysManager::P_PGM_ERR;
+  if (*p_stage == 0)
+  {
+    *data_ptr = calloc(1, sizeof(VM_State));
+    *p_stage = 1;
+  }
+  VM_State *s = (VM_State *)*data_ptr;
+  if (s->len && s->len != c.len)
+    return SysUtils::SysManager::P_PGM_ERR; // script replaced under us
+  s->len = c.len;
+  c.pc = s->pc;
+
+  static void *const labels[NUM_OPS] = {
+      &&op_halt, &&op_ldi, &&op_mov, &&op_add, &&op_sub, &&op_mul,
+      &&op_div, &&op_tlm, &&op_waitlt, &&op_waitgt, &&op_sleep, &&op_jmp,
+      &&op_blt, &&op_bge, &&op_verb, &&op_krel, &&op_ctl, &&op_stage};
+  int budget = VM_STEP_OPS;
+  int ret = SysUtils::SysManager::P_RUN;
+  uint16_t ip = c.pc; // start of the current instruction
+  uint8_t op = NUM_OPS, a, b;
+  float *r1, *r2, x;
+  unsigned long t_step = micros(), t_op = t_step;
+
+// account the previous instruction, then dispatch the next one
+#if VM_PROFILE
+#define VM_PROFILE_OP()         \
+  {                             \
+    unsigned long t = micros(); \
+    if (op < NUM_OPS)           \
+      op_us[op] += t - t_op;    \
+    t_op = t;                   \
+  }
+#else
+#define VM_PROFILE_OP()
+#endif
+#define VM_NEXT()      \
+  {                    \
+    VM_PROFILE_OP();   \
+    if (c.err)         \
+      goto fault;      \
+    if (budget-- == 0) \
+      goto yield;      \
+    ip = c.pc;         \
+    op = fetch(&c);    \
+    if (op >= NUM_OPS) \
+      goto fault;      \
+    op_count[op] += 1; \
+    goto *labels[op];  \
+  }
+#define VM_REG(p)         \
+  {                       \
+    a = fetch(&c);        \
+    if (a >= VM_NUM_REGS) \
+      goto fault;         \
+    p = s->r + a;         \
+  }
+
+  VM_NEXT();
+
+op_halt:
+  ret = SysUtils::SysManager::P_COMPLETE;
+  goto done;
+op_ldi:
+  VM_REG(r1);
+  *r1 = fetch_imm(&c);
+  VM_NEXT();
+op_mov:
+  VM_REG(r1);
+  VM_REG(r2);
+  *r1 = *r2;
+  VM_NEXT();
+op_add:
+  VM_REG(r1);
+  VM_REG(r2);
+  *r1 += *r2;
+  VM_NEXT();
+op_sub:
+  VM_REG(r1);
+  VM_REG(r2);
+  *r1 -= *r2;
+  VM_NEXT();
+op_mul:
+  VM_REG(r1);
+  VM_REG(r2);
+  *r1 *= *r2;
+  VM_NEXT();
+op_div:
+  VM_REG(r1);
+  VM_REG(r2);
+  *r1 /= *r2;
+  VM_NEXT();
+op_tlm:
+  VM_REG(r1);
+  b = fetch(&c);
+  if (b >= Telemetry::NUM_CH)
+    goto fault;
+  Telemetry::estimate(b, millis(), r1);
+  VM_NEXT();
+op_waitlt:
+op_waitgt:
+  b = fetch(&c); // VM_REG() uses a
+  VM_REG(r2);
+  if (b >= Telemetry::NUM_CH)
+    goto fault;
+  if (!Telemetry::estimate(b, millis(), &x) ||
+      (op == OP_WAITLT ? !(x < *r2) : !(x > *r2)))
+  {
+    // new samples, or the extrapolation crossing over, end the wait
+    SysUtils::sys->sleep_program(VM_WAIT_MS);
+    SysUtils::sys->wait_events(SysUtils::SysManager::EV_TLM);
+    goto wait;
+  }
+  VM_NEXT();
+op_sleep:
+  SysUtils::sys->sleep_program(fetch16(&c));
+  if (c.err)
+    goto fault;
+  goto yield;
+op_jmp:
+  c.pc = fetch16(&c);
+  VM_NEXT();
+op_blt:
+op_bge:
+  VM_REG(r1);
+  VM_REG(r2);
+  {
+    uint16_t to = fetch16(&c);
+    if ((op == OP_BLT) == (*r1 < *r2))
+      c.pc = to;
+  }
+  VM_NEXT();
+op_verb:
+  a = fetch(&c);
+  b = fetch(&c);
+  if (c.err)
+    goto fault;
+  SysUtils::sys->request_vn(a, b, true);
+  SysUtils::sys->keyrel_req = SysUtils::SysManager::KYRL_NULL;
+  VM_NEXT();
+op_krel:
+  a = fetch(&c);
+  b = fetch(&c);
+  {
+    uint16_t to = fetch16(&c);
+    if (c.err)
+      goto fault;
+    if (!s->krel) // new request; wait for the operator
+    {
+      SysUtils::sys->request_vn(a, b);
+      s->krel = true;
+      goto wait_krel;
+    }
+    if (SysUtils::sys->keyrel_req == SysUtils::SysManager::KYRL_ACC)
+      s->krel = false;
+    else if (SysUtils::sys->keyrel_req == SysUtils::SysManager::KYRL_REJ)
+    {
+      s->krel = false;
+      c.pc = to;
+    }
+    else
+      goto wait_krel;
+    SysUtils::sys->keyrel_req = SysUtils::SysManager::KYRL_NULL;
+  }
+  VM_NEXT();
+op_ctl:
+  b = fetch(&c);
+  VM_REG(r2);
+  if (c.err || 0 != Comm::set_control(b, *r2))
+    goto fault;
+  budget = 0; // one kRPC call per step
+  VM_NEXT();
+op_stage:
+  if (0 != Comm::stage())
+    goto fault;
+  budget = 0;
+  VM_NEXT();
+
+wait_krel:
+  SysUtils::sys->wait_events(SysUtils::SysManager::EV_KYRL_ACC |
+                             SysUtils::SysManager::EV_KYRL_REJ);
+wait: // retry the instruction once woken
+  c.pc = ip;
+  goto yield;
+fault:
+  fault_pc = ip;
+  ret = SysUtils::SysManager::P_PGM_ERR;
+  c.pc = ip;
+yield:
+done:
+  VM_PROFILE_OP();
+  s->pc = c.pc;
+  steps += 1;
+  t_step = micros() - t_step;
+  if (t_step > step_us_max)
+    step_us_max = t_step;
+  return ret;
+
+#undef VM_NEXT
+#undef VM_REG
+#undef VM_PROFILE_OP
+}
+
+/* ===== script upload ===== */
+// NOTE: protocol, host to LDSKY over Serial: "SC", u16 length,
+//       u16 CRC16 of the code, then the code in VM_UPLOAD_CHUNK-byte
+//       chunks; LDSKY answers '+' once a chunk is queued for EEPROM, '='
+//       when the script is stored, '!' on errors (see tools/vmasm.py)
+// NOTE: the header is written last, so a broken upload fails the CRC
+//       check instead of running half a script
+
+struct Upload
+{
+  uint8_t stage;     // 0: header, 1: code, 2: header write
+  uint8_t hdr_i;     // header bytes received
+  uint8_t hdr[6];    // "SC", length, CRC
+  uint16_t len, pos; // code length, code bytes received
+  uint16_t crc;      // CRC of the code received so far
+  uint8_t buf_i;     // bytes in buf
+  uint8_t buf[VM_UPLOAD_CHUNK];
+  unsigned long last_rx; // time of the last received byte
+};
+
+// step an upload into EEPROM slot; returns 1 while in progress, 0 when
+// done, -1 on errors
+int upload_step(Upload *u, int slot)
+{
+  unsigned long t = millis();
+  if (u->last_rx == 0)
+    u->last_rx = t;
+  if (t - u->last_rx > VM_UPLOAD_TIMEOUT)
+    return -1;
+  if (u->stage == 2) // code queued; commit the header
+  {
+    uint16_t hdr[2] = {u->len, u->crc};
+    if (0 != Storage::ee_write(slot_addr(slot), hdr, HEADER_LEN))
+      return 1; // queue full, retry
+    Serial.write('=');
+    return 0;
+  }
+  if (u->buf_i == VM_UPLOAD_CHUNK ||
+      (u->stage == 1 && u->pos == u->len && u->buf_i))
+  {
+    uint16_t addr = slot_addr(slot) + HEADER_LEN + u->pos - u->buf_i;
+    if (0 != Storage::ee_write(addr, u->buf, u->buf_i))
+      return 1; // queue full, retry
+    u->buf_i = 0;
+    Serial.write('+');
+  }
+  while (Serial.available() && u->buf_i < VM_UPLOAD_CHUNK &&
+         !(u->stage == 1 && u->pos == u->len))
+  {
+    uint8_t v = Serial.read();
+    u->last_rx = t;
+    if (u->stage == 0)
+    {
+      u->hdr[u->hdr_i++] = v;
+      if ((u->hdr_i == 1 && v != 'S') || (u->hdr_i == 2 && v != 'C'))
+        u->hdr_i = 0; // resync on the magic
+      if (u->hdr_i == sizeof(u->hdr))
+      {
+        u->len = u->hdr[2] | (uint16_t)u->hdr[3] << 8;
+        if (u->len == 0 || u->len > CODE_LEN)
+        {
+          Serial.write('!');
+          return -1;
+        }
+        u->crc = 0xFFFF;
+        u->stage = 1;
+      }
+      continue;
+    }
+    u->buf[u->buf_i++] = v;
+    u->pos += 1;
+    u->crc = _crc16_update(u->crc, v);
+  }
+  if (u->stage == 1 && u->pos == u->len && u->buf_i == 0)
+  {
+    if (u->crc != (u->hdr[4] | (uint16_t)u->hdr[5] << 8))
+    {
+      Serial.write('!');
+      return -1;
+    }
+    u->stage = 2;
+  }
+  return 1;
+}
+
+} // namespace VM
+
+#endif // VM_H
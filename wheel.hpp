@@ -0,0 +1,281 @@
+/*
+ * Timer wheel
+ * Periodic and one-shot callbacks on a single 1 kHz tick (Timer3, see
+ * System::timer_init()); callbacks are registered once with add(), then
+ * started and stopped in milliseconds
+ * NOTE: a callback runs in one of three contexts (mode_t):
+ *       W_ISR     in the tick ISR, interrupts off; keep it short
+ *       W_NOBLOCK in the tick ISR with interrupts on, so the USARTs and
+ *                 millis() keep running through it (e.g. the screen
+ *                 update); never nests
+ *       W_DEFER   from the main loop, in run_deferred()
+ * NOTE: hierarchical wheel: LEVELS levels of SLOTS slots, each level
+ *       SLOTS times coarser than the one below. Starting, stopping and
+ *       expiring a timer are O(1); a timer moves down at most once per
+ *       level on its way to expiry
+ * NOTE: a timer that comes due while its last run is still pending or
+ *       running is skipped and counts an overrun
+ */
+
+#ifndef WHEEL_H
+#define WHEEL_H
+
+#include "base.h"
+
+namespace Wheel
+{
+
+enum mode_t // callback contexts
+{
+  W_ISR,
+  W_NOBLOCK,
+  W_DEFER
+};
+
+typedef void (*callback_t)();
+
+const uint8_t SLOT_BITS = 5;
+const uint8_t SLOTS = 1 << SLOT_BITS;
+const uint8_t LEVELS = 3; // horizon: SLOTS^LEVELS ms, about 32 s
+const uint32_t HORIZON = 1UL << SLOT_BITS * LEVELS;
+static_assert(WHEEL_TIMERS <= 8, "timer masks are 8 bits");
+
+struct Timer
+{
+  callback_t fn;
+  uint8_t mode;            // mode_t
+  bool armed;              // started, not expired or stopped
+  uint8_t prev, next;      // slot list links: timer id + 1, 0 for none
+  uint8_t level, slot;     // slot the timer is filed in
+  uint32_t deadline;       // tick of the next run
+  uint16_t period;         // in ms; 0: one-shot
+  unsigned long runs;      // callbacks run
+  unsigned int overruns;   // runs skipped, last one unfinished
+};
+Timer timers[WHEEL_TIMERS];
+uint8_t num_timers = 0;
+uint8_t slots[LEVELS][SLOTS]; // list heads: timer id + 1, 0 for none
+
+volatile uint32_t now = 0;       // ticks since timer_init(), in ms
+volatile uint8_t firing = 0;     // W_ISR timers expired this tick
+volatile uint8_t nb_due = 0;     // W_NOBLOCK timers waiting to run
+volatile uint8_t nb_running = 0; // W_NOBLOCK timer running
+volatile bool nb_busy = false;   // interrupts on for W_NOBLOCK callbacks
+volatile uint8_t deferred = 0;   // W_DEFER timers waiting to run
+
+/* ===== slot lists ===== */
+// NOTE: call with interrupts off
+
+void unlink(uint8_t id)
+{
+  Timer *t = &timers[id];
+  if (t->prev)
+    timers[t->prev - 1].next = t->next;
+  else
+    slots[t->level][t->slot] = t->next;
+  if (t->next)
+    timers[t->next - 1].prev = t->prev;
+}
+
+// file timer id by its deadline: the lowest level whose slots reach it
+// NOTE: deadlines past the horizon park in the last slot and are filed
+//       again from there
+void link(uint8_t id)
+{
+  Timer *t = &timers[id];
+  uint32_t at = t->deadline;
+  if (at - now >= HORIZON)
+    at = now + HORIZON - 1;
+  uint8_t l = 0;
+  while (l < LEVELS - 1 && at - now >= 1UL << SLOT_BITS * (l + 1))
+    l++;
+  t->level = l;
+  t->slot = (at >> SLOT_BITS * l) & (SLOTS - 1);
+  uint8_t *head = &slots[l][t->slot];
+  t->prev = 0;
+  t->next = *head;
+  if (*head)
+    timers[*head - 1].prev = id + 1;
+  *head = id + 1;
+}
+
+// move the timers of a slot down to the level below
+void cascade(uint8_t l, uint8_t s)
+{
+  uint8_t id = slots[l][s];
+  slots[l][s] = 0;
+  while (id)
+  {
+    uint8_t next = timers[id - 1].next;
+    link(id - 1);
+    id = next;
+  }
+}
+
+/* ===== tick ===== */
+
+void expire(uint8_t id)
+{
+  Timer *t = &timers[id];
+  uint8_t bit = 1 << id;
+  if (t->period)
+  {
+    t->deadline += t->period; // keeps the phase
+    link(id);
+  }
+  else
+    t->armed = false;
+  if (t->mode == W_ISR)
+    firing |= bit;
+  else if (t->mode == W_NOBLOCK)
+  {
+    if ((nb_due | nb_running) & bit)
+      t->overruns += 1;
+    else
+      nb_due |= bit;
+  }
+  else
+  {
+    if (deferred & bit)
+      t->overruns += 1;
+    else
+      deferred |= bit;
+  }
+}
+
+inline uint8_t lowest(uint8_t mask)
+{
+  uint8_t id = 0;
+  while (!(mask & 1 << id))
+    id++;
+  return id;
+}
+
+// advance the wheel by 1 ms; call from the 1 kHz timer ISR
+// NOTE: W_NOBLOCK callbacks run last, with interrupts on; a tick that
+//       comes in meanwhile runs its W_ISR callbacks and returns
+void tick_isr()
+{
+  now += 1;
+  for (uint8_t l = 1; l < LEVELS; l++)
+  {
+    if ((now >> SLOT_BITS * (l - 1)) & (SLOTS - 1))
+      break;
+    cascade(l, (now >> SLOT_BITS * l) & (SLOTS - 1));
+  }
+  uint8_t *head = &slots[0][now & (SLOTS - 1)];
+  while (*head)
+  {
+    uint8_t id = *head - 1;
+    *head = timers[id].next;
+    if (*head)
+      timers[*head - 1].prev = 0;
+    expire(id);
+  }
+  while (firing)
+  {
+    uint8_t id = lowest(firing);
+    firing &= ~(1 << id);
+    timers[id].runs += 1;
+    timers[id].fn();
+  }
+  if (nb_busy || !nb_due)
+    return;
+  nb_busy = true;
+  while (nb_due)
+  {
+    uint8_t id = lowest(nb_due);
+    nb_due &= ~(1 << id);
+    nb_running = 1 << id;
+    timers[id].runs += 1;
+    sei();
+    timers[id].fn();
+    cli();
+    nb_running = 0;
+  }
+  nb_busy = false;
+}
+
+/* ===== timers ===== */
+
+// register callback fn to run in mode (mode_t); returns the timer id,
+// or -1 if all WHEEL_TIMERS are taken
+int add(callback_t fn, uint8_t mode)
+{
+  if (num_timers >= WHEEL_TIMERS)
+    return -1;
+  timers[num_timers].fn = fn;
+  timers[num_timers].mode = mode;
+  return num_timers++;
+}
+
+// (re)start timer id: first run in delay ms (at least 1), then every
+// period ms, or only once if period is 0
+void start(uint8_t id, uint16_t delay, uint16_t period)
+{
+  Timer *t = &timers[id];
+  uint8_t sreg = SREG;
+  cli();
+  if (t->armed)
+    unlink(id);
+  t->deadline = now + (delay ? delay : 1);
+  t->period = period;
+  t->armed = true;
+  link(id);
+  SREG = sreg;
+}
+
+// stop timer id; a run already due is dropped too
+void stop(uint8_t id)
+{
+  uint8_t sreg = SREG;
+  cli();
+  if (timers[id].armed)
+    unlink(id);
+  timers[id].armed = false;
+  firing &= ~(1 << id);
+  nb_due &= ~(1 << id);
+  deferred &= ~(1 << id);
+  SREG = sreg;
+}
+
+// change the period of timer id
+// NOTE: the next run comes at most one new period from now
+void set_period(uint8_t id, uint16_t period)
+{
+  Timer *t = &timers[id];
+  uint8_t sreg = SREG;
+  cli();
+  t->period = period;
+  if (t->armed && period && t->deadline - now > period)
+  {
+    unlink(id);
+    t->deadline = now + period;
+    link(id);
+  }
+  SREG = sreg;
+}
+
+bool deferred_pending()
+{
+  return deferred;
+}
+
+// run the W_DEFER callbacks that came due; call from the main loop
+void run_deferred()
+{
+  while (deferred)
+  {
+    uint8_t id = lowest(deferred);
+    uint8_t sreg = SREG;
+    cli();
+    deferred &= ~(1 << id);
+    SREG = sreg;
+    timers[id].runs += 1;
+    timers[id].fn();
+  }
+}
+
+} // namespace Wheel
+
+#endif // WHEEL_H